@@ -0,0 +1,107 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+// Replacement operator new and delete that count every allocation in
+// g_allocationCount, which includes all containers.  Programs that report allocation
+// counts build this in; a library can't, as replacements in a static library are
+// only linked into programs that refer to something else in the same object.
+//
+// Every form is replaced, so aligned and nothrow allocations are counted too, and each
+// delete frees memory the way its new allocated it.
+
+#include "ConversionStats.h"
+
+#include <stdlib.h>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// GCC takes free() of what operator new returned for a mismatched new and delete,
+// although here operator new is malloc() underneath
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace
+{
+    void* Allocate(size_t size)
+    {
+        g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+        if (void* p = malloc(size ? size : 1)) return p;
+        throw std::bad_alloc();
+    }
+
+    void* AllocateAligned(size_t size, std::align_val_t alignment)
+    {
+        g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+        size_t const align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+        if (void* p = _aligned_malloc(size ? size : 1, align)) return p;
+#else
+        // aligned_alloc() needs a size that is a multiple of the alignment
+        size_t const rounded = (size + align - 1) / align * align;
+        if (void* p = aligned_alloc(align, rounded ? rounded : align)) return p;
+#endif
+        throw std::bad_alloc();
+    }
+
+    void FreeAligned(void* p) noexcept
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return AllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocateAligned(size, alignment); }
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+    try { return Allocate(size); } catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+    try { return Allocate(size); } catch (...) { return nullptr; }
+}
+
+void* operator new(size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    try { return AllocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    try { return AllocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::nothrow_t const&) noexcept { free(p); }
+void operator delete[](void* p, std::nothrow_t const&) noexcept { free(p); }
+
+void operator delete(void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, std::align_val_t, std::nothrow_t const&) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t, std::nothrow_t const&) noexcept { FreeAligned(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
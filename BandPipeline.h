@@ -0,0 +1,190 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "TextBuffer.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads to use when the user asks for "all of them"
+
+inline int HardwareThreadCount() noexcept
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : int(n);
+}
+
+// Pick a band height giving each band enough pixels to amortize the hand-off
+// between threads, while keeping the text buffered for bands in flight small
+
+inline int RowsPerBand(int width) noexcept
+{
+    constexpr int pixelsPerBand = 16384;
+    return std::max(1, pixelsPerBand / std::max(1, width));
+}
+
+// Split rows [0, rowCount) into bands of bandRows rows, and serialize each band into
+// its own TextBuffer on a pool of worker threads.  Bands are handed to "consume" on the
+// calling thread strictly in order, so output is identical to a serial loop.  At most
+// two bands per thread are in flight, which bounds memory use regardless of image size.
+//
+// Each band's input is first fetched by "read", which is called for one band at a time
+// in band order, so it can read from a sequential stream such as a file.  Bands then
+// proceed in parallel, each with its own Input, which is reused for later bands, so
+// "produce" may also keep its scratch space there.
+//
+//   read(int band, int rowBegin, int rowEnd, Input& input) -> bool, false on failure
+//   produce(int band, int rowBegin, int rowEnd, Input& input, TextBuffer& text) -> void
+//   consume(int band, TextBuffer const& text) -> bool, false to stop early
+//
+// Returns false if "read" failed or "consume" stopped the pipeline.  Each TextBuffer
+// starts with textCapacity chars, if that is known to be about what a band needs.
+
+template <typename Input, typename Read, typename Produce, typename Consume>
+bool ForEachBandOrdered(int rowCount, int bandRows, int threadCount, Read&& read, Produce&& produce, Consume&& consume,
+    size_t textCapacity = 0)
+{
+    int bandCount = (rowCount + bandRows - 1) / bandRows;
+
+    auto bandBegin = [&](int band) { return band * bandRows; };
+    auto bandEnd   = [&](int band) { return std::min(rowCount, (band + 1) * bandRows); };
+
+    if (threadCount <= 1 || bandCount <= 1)
+    {
+        Input input;
+        TextBuffer text;
+        text.Reserve(textCapacity);
+        for (int band = 0; band < bandCount; ++band)
+        {
+            if (!read(band, bandBegin(band), bandEnd(band), input)) return false;
+            text.Clear();
+            produce(band, bandBegin(band), bandEnd(band), input, text);
+            if (!consume(band, static_cast<TextBuffer const&>(text))) return false;
+        }
+        return true;
+    }
+
+    struct Slot
+    {
+        Input input;
+        TextBuffer text;
+        bool ready = false;
+        bool failed = false;
+    };
+
+    int const window = 2 * threadCount;
+    std::vector<Slot> slots(window);
+    for (Slot& slot : slots)
+    {
+        slot.text.Reserve(textCapacity);
+    }
+
+    std::mutex readMutex; // Held while claiming and reading a band, so reads are in order
+    std::mutex mutex;
+    std::condition_variable bandReady;
+    std::condition_variable slotFree;
+    int nextBand = 0;     // Next band to be claimed by a worker
+    int consumed = 0;     // Bands handed to "consume" so far
+    bool stopped = false;
+
+    auto worker = [&]()
+    {
+        for (;;)
+        {
+            int band;
+            bool readOk;
+            {
+                std::lock_guard<std::mutex> readLock(readMutex);
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slotFree.wait(lock, [&] { return stopped || nextBand >= bandCount || nextBand < consumed + window; });
+                    if (stopped || nextBand >= bandCount) return;
+                    band = nextBand++;
+                }
+
+                // Slot is exclusively owned by this worker until it is marked ready
+                readOk = read(band, bandBegin(band), bandEnd(band), slots[band % window].input);
+            }
+
+            Slot& slot = slots[band % window];
+            slot.text.Clear();
+            if (readOk)
+            {
+                produce(band, bandBegin(band), bandEnd(band), slot.input, slot.text);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.ready = true;
+                slot.failed = !readOk;
+                if (!readOk) stopped = true;
+            }
+            bandReady.notify_all();
+            if (!readOk) slotFree.notify_all();
+        }
+    };
+
+    int workerCount = std::min(threadCount, bandCount);
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount);
+    for (int i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+
+    bool ok = true;
+    for (int band = 0; band < bandCount && ok; ++band)
+    {
+        Slot& slot = slots[band % window];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bandReady.wait(lock, [&] { return slot.ready; });
+        }
+
+        ok = !slot.failed && consume(band, static_cast<TextBuffer const&>(slot.text));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.ready = false;
+            consumed = band + 1;
+            if (!ok) stopped = true;
+        }
+        slotFree.notify_all();
+    }
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+
+    return ok;
+}
+
+// As above, for bands that need no input other than their row range:
+//
+//   produce(int band, int rowBegin, int rowEnd, TextBuffer& text) -> void
+//   consume(int band, TextBuffer const& text) -> bool, false to stop early
+
+template <typename Produce, typename Consume>
+bool ForEachBandOrdered(int rowCount, int bandRows, int threadCount, Produce&& produce, Consume&& consume)
+{
+    struct NoInput {};
+
+    return ForEachBandOrdered<NoInput>(rowCount, bandRows, threadCount,
+        [](int, int, int, NoInput&) { return true; },
+        [&](int band, int rowBegin, int rowEnd, NoInput&, TextBuffer& text)
+        {
+            produce(band, rowBegin, rowEnd, text);
+        },
+        consume);
+}
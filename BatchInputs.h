@@ -0,0 +1,175 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// One input file of a batch conversion, and where its output goes
+
+struct BatchFile
+{
+    std::filesystem::path input;
+    std::filesystem::path output;
+    uintmax_t size;
+};
+
+// Match a file name against a pattern where "*" matches any run of chars and "?"
+// matches any single char
+
+inline bool MatchWildcard(char const* pattern, char const* name) noexcept
+{
+    char const* starPattern = nullptr; // Just after the last "*" seen
+    char const* starName = nullptr;    // Where the chars that "*" matches end, so far
+
+    while (*name)
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starName = name;
+        }
+        else if (*pattern == '?' || *pattern == *name)
+        {
+            ++pattern;
+            ++name;
+        }
+        else if (starPattern)
+        {
+            // Let the last "*" match one more char, and retry from there
+            pattern = starPattern;
+            name = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
+
+inline bool HasWildcard(std::string const& s) noexcept
+{
+    return s.find_first_of("*?") != std::string::npos;
+}
+
+// True for extensions of the image formats stb_image can read
+
+inline bool HasImageExtension(std::filesystem::path const& path)
+{
+    static char const* const extensions[] = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm", ".ppm", ".pgm" };
+
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(tolower((unsigned char)c)); });
+    return std::find(std::begin(extensions), std::end(extensions), ext) != std::end(extensions);
+}
+
+// Expand batch input specs into a list of files.  Each spec is a file, a directory,
+// whose image files are all converted, including those in subdirectories, or a file
+// name pattern with wildcards (in the last path component only), which also only
+// matches image files, so earlier outputs are never picked up as inputs.  Outputs are written
+// next to their inputs, or if outputDir isn't empty, under it, keeping the path of each
+// input relative to its directory or pattern, with the extension changed to outputExtension.
+//
+// Files named by more than one spec are only converted once.  Files are returned
+// largest first, since bigger files usually take longer, which is the order
+// ForEachTaskStealing wants.  Returns false, with an error message, if any spec names
+// nothing, or if two inputs would be written to the same output, like a.png and a.gif.
+
+inline bool ExpandBatchInputs(std::vector<std::string> const& specs, std::filesystem::path const& outputDir,
+    char const* outputExtension, std::vector<BatchFile>& files, std::string& error)
+{
+    namespace fs = std::filesystem;
+
+    std::map<fs::path, fs::path> inputOf; // By canonical output path, the canonical input path
+    size_t found = 0;
+
+    auto add = [&](fs::path const& input, fs::path const& relative)
+    {
+        ++found;
+
+        fs::path output = outputDir.empty() ? input : outputDir / relative;
+        output.replace_extension(outputExtension);
+
+        std::error_code ec;
+        fs::path canonicalInput = fs::weakly_canonical(input, ec);
+        auto result = inputOf.emplace(fs::weakly_canonical(output, ec), canonicalInput);
+        if (!result.second)
+        {
+            if (result.first->second != canonicalInput && error.empty())
+            {
+                error = "Both " + result.first->second.string() + " and " + canonicalInput.string()
+                    + " would be written to " + output.string();
+            }
+            return;
+        }
+
+        uintmax_t size = fs::file_size(input, ec);
+        files.push_back(BatchFile{input, output, ec ? 0 : size});
+    };
+
+    for (std::string const& spec : specs)
+    {
+        fs::path path(spec);
+        std::error_code ec;
+        size_t foundBefore = found;
+
+        if (HasWildcard(path.filename().string()))
+        {
+            fs::path dir = path.has_parent_path() ? path.parent_path() : fs::path(".");
+            std::string pattern = path.filename().string();
+            for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec))
+            {
+                fs::path name = it->path().filename();
+                if (it->is_regular_file() && HasImageExtension(name) && MatchWildcard(pattern.c_str(), name.string().c_str()))
+                {
+                    add(path.has_parent_path() ? it->path() : name, name);
+                }
+            }
+        }
+        else if (fs::is_directory(path, ec))
+        {
+            for (auto it = fs::recursive_directory_iterator(path, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+            {
+                if (it->is_regular_file() && HasImageExtension(it->path()))
+                {
+                    add(it->path(), it->path().lexically_relative(path));
+                }
+            }
+        }
+        else if (fs::is_regular_file(path, ec))
+        {
+            add(path, path.filename());
+        }
+
+        if (found == foundBefore)
+        {
+            error = "No input files found for \"" + spec + "\"";
+            return false;
+        }
+    }
+
+    if (!error.empty()) return false;
+
+    std::stable_sort(files.begin(), files.end(), [](BatchFile const& a, BatchFile const& b)
+    {
+        return a.size != b.size ? a.size > b.size : a.input < b.input;
+    });
+
+    return true;
+}
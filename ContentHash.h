@@ -0,0 +1,120 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+
+// 64-bit hash of a block of data: XXH64, by Yann Collet, which reads 32 bytes per step
+// in four independent lanes, so hashing a decoded image takes a small fraction of the
+// time to convert it.  The result doesn't depend on the byte order of the machine.
+
+namespace xxh64
+{
+    constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t RotateLeft(uint64_t x, int bits) noexcept { return (x << bits) | (x >> (64 - bits)); }
+
+    inline uint64_t Read64(unsigned char const* p) noexcept
+    {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+        {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    inline uint32_t Read32(unsigned char const* p) noexcept
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    inline uint64_t Round(uint64_t acc, uint64_t input) noexcept
+    {
+        acc += input * Prime2;
+        return RotateLeft(acc, 31) * Prime1;
+    }
+
+    inline uint64_t MergeRound(uint64_t acc, uint64_t lane) noexcept
+    {
+        acc ^= Round(0, lane);
+        return acc * Prime1 + Prime4;
+    }
+}
+
+inline uint64_t ContentHash(void const* data, size_t size, uint64_t seed = 0) noexcept
+{
+    using namespace xxh64;
+
+    auto const* p = static_cast<unsigned char const*>(data);
+    auto const* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+        for (; end - p >= 32; p += 32)
+        {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+        }
+        h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    }
+    else
+    {
+        h = seed + Prime5;
+    }
+
+    h += uint64_t(size);
+
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= Round(0, Read64(p));
+        h = RotateLeft(h, 27) * Prime1 + Prime4;
+    }
+    if (end - p >= 4)
+    {
+        h ^= uint64_t(Read32(p)) * Prime1;
+        h = RotateLeft(h, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * Prime5;
+        h = RotateLeft(h, 11) * Prime1;
+    }
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t ContentHash(std::string_view str, uint64_t seed = 0) noexcept
+{
+    return ContentHash(str.data(), str.size(), seed);
+}
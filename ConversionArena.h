@@ -0,0 +1,94 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+// Memory for the shape lists and scratch space of conversions, reused from one image to
+// the next.  Each conversion allocates from a monotonic arena over a block the
+// ConversionArena keeps.  What doesn't fit comes from the heap, and the block
+// is grown to hold it all for the next image, up to MaxBlockSize.  So once a thread
+// has converted a few images of a batch, its conversions allocate nothing for shapes.
+// Not thread safe; each thread that converts needs one of its own.
+
+class ConversionArena
+{
+public:
+    static constexpr size_t MaxBlockSize = 64 << 20;
+
+private:
+    // Passes allocations on to the heap, adding up how much the arena took from it
+    struct HeapResource : std::pmr::memory_resource
+    {
+        size_t allocated = 0;
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            void* p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            allocated += bytes;
+            return p;
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    std::unique_ptr<std::byte[]> block;
+    size_t blockSize = 0;
+    size_t wantedSize = 0;  // What the last conversion used, for the next block
+    HeapResource heap;
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+
+public:
+    ConversionArena() = default;
+    ConversionArena(ConversionArena const& other) = delete;
+    ConversionArena& operator=(ConversionArena const& other) = delete;
+
+    ~ConversionArena()
+    {
+        Release();
+    }
+
+    // Start a conversion's allocations, with room for about "expected" bytes before any
+    // come from the heap.  Whatever the previous conversion allocated is released first.
+    std::pmr::memory_resource* Begin(size_t expected)
+    {
+        Release();
+
+        size_t size = std::min(std::max(expected, wantedSize), MaxBlockSize);
+        if (size > blockSize)
+        {
+            block.reset();
+            block.reset(new std::byte[size]);
+            blockSize = size;
+        }
+        arena.emplace(block.get(), blockSize, &heap);
+        return &*arena;
+    }
+
+    // Free everything allocated since Begin(), keeping the block for the next conversion
+    void Release() noexcept
+    {
+        if (!arena) return;
+        arena.reset();
+        wantedSize = blockSize + heap.allocated;
+        heap.allocated = 0;
+    }
+};
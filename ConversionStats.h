@@ -0,0 +1,205 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+// Count of allocations made through operator new, incremented by the replacement
+// operator new of the program, if it has one.  Otherwise it stays 0.
+inline std::atomic<uint64_t> g_allocationCount{0};
+
+// Phases of a conversion, timed separately:
+// - decode: reading and decoding the input image
+// - convert: converting pixels to RGBA, and indexing and reducing colors
+// - merge: combining pixels into shapes, and bucketing shapes by color
+// - serialize: formatting shapes as SVG text
+// - write: handing text to the output, including compressing and writing the file
+enum class Phase
+{
+    decode,
+    convert,
+    merge,
+    serialize,
+    write
+};
+
+inline constexpr int PhaseCount = 5;
+inline constexpr char const* PhaseNames[PhaseCount] = {"decode", "convert", "merge", "serialize", "write"};
+
+// Times and counts of one conversion, or of all the files of a batch.  Everything is
+// atomic, so the threads converting bands, or files, can all add to one object.
+// Phase times are summed over threads, so phases run in parallel can add up to more
+// than the elapsed time.
+
+struct ConversionStats
+{
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point startTime = clock::now();
+    uint64_t startAllocations = g_allocationCount;
+
+    std::atomic<int64_t> phaseNanos[PhaseCount] = {};
+    std::atomic<uint64_t> images{0};    // Converted successfully
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> pixels{0};
+    std::atomic<uint64_t> elements{0};  // SVG shape elements, including any background
+    std::atomic<uint64_t> svgBytes{0};  // Uncompressed
+    std::atomic<uint64_t> fileBytes{0}; // As written to output files
+    std::atomic<uint64_t> colors{0};    // Distinct colors after any reduction, summed over images
+    std::atomic<uint64_t> cacheHits{0};   // Output files copied from the cache
+    std::atomic<uint64_t> cacheMisses{0}; // Output files converted and added to the cache
+    std::atomic<uint64_t> reusedRows{0};  // Copied from a previous SVG by --diff-from
+    std::atomic<uint64_t> reusedTiles{0}; // Left as they were by --diff-from, or the same as others
+    std::atomic<uint64_t> reusedFrames{0}; // The same as earlier frames of an animation
+
+    // Set by Finish()
+    double elapsedMs = 0;
+    uint64_t allocations = 0;
+
+    void AddTime(Phase phase, clock::duration dur) noexcept
+    {
+        phaseNanos[int(phase)].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count(),
+                                         std::memory_order_relaxed);
+    }
+
+    double PhaseMs(int phase) const noexcept { return phaseNanos[phase] / 1e6; }
+
+    // Take the elapsed time and allocation count since construction, for the reports
+    void Finish() noexcept
+    {
+        elapsedMs = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+        allocations = g_allocationCount - startAllocations;
+    }
+
+    // Human-readable table
+
+    void WriteReport(std::ostream& out) const
+    {
+        auto flags = out.flags();
+        auto precision = out.precision();
+
+        out << "Statistics for " << images << " image" << (images == 1 ? "" : "s");
+        if (failures) out << " (" << failures << " failed)";
+        out << ":\n" << std::fixed << std::setprecision(2);
+        for (int p = 0; p < PhaseCount; ++p)
+        {
+            out << "  " << std::left << std::setw(14) << PhaseNames[p]
+                << std::right << std::setw(12) << PhaseMs(p) << " ms\n";
+        }
+        out << "  " << std::left << std::setw(14) << "elapsed" << std::right << std::setw(12) << elapsedMs << " ms\n";
+
+        auto counter = [&](char const* name, uint64_t value)
+        {
+            out << "  " << std::left << std::setw(14) << name << std::right << std::setw(12) << value << "\n";
+        };
+        counter("pixels", pixels);
+        counter("elements", elements);
+        counter("colors", colors);
+        counter("svg bytes", svgBytes);
+        counter("file bytes", fileBytes);
+        counter("allocations", allocations);
+        counter("cache hits", cacheHits);
+        counter("cache misses", cacheMisses);
+        counter("reused rows", reusedRows);
+        counter("reused tiles", reusedTiles);
+        counter("reused frames", reusedFrames);
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    // One JSON object, on one line
+
+    void WriteJson(std::ostream& out) const
+    {
+        auto flags = out.flags();
+        auto precision = out.precision();
+
+        out << std::fixed << std::setprecision(3)
+            << "{\"images\":" << images
+            << ",\"failures\":" << failures
+            << ",\"elapsed_ms\":" << elapsedMs
+            << ",\"phases_ms\":{";
+        for (int p = 0; p < PhaseCount; ++p)
+        {
+            out << (p ? "," : "") << '"' << PhaseNames[p] << "\":" << PhaseMs(p);
+        }
+        out << "},\"pixels\":" << pixels
+            << ",\"elements\":" << elements
+            << ",\"colors\":" << colors
+            << ",\"svg_bytes\":" << svgBytes
+            << ",\"file_bytes\":" << fileBytes
+            << ",\"allocations\":" << allocations
+            << ",\"cache_hits\":" << cacheHits
+            << ",\"cache_misses\":" << cacheMisses
+            << ",\"reused_rows\":" << reusedRows
+            << ",\"reused_tiles\":" << reusedTiles
+            << ",\"reused_frames\":" << reusedFrames
+            << "}\n";
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+// Times a stretch of work on one thread, adding it to a phase of the stats when stopped
+// or destroyed.  The time can be split among phases with Switch(), and is only added to
+// the stats at the end, so timing short steps doesn't touch shared counters.  Does
+// nothing if stats is null.
+
+class PhaseTimer
+{
+    using clock = ConversionStats::clock;
+
+    ConversionStats* stats;
+    Phase phase;
+    clock::time_point since;
+    clock::duration times[PhaseCount] = {};
+
+public:
+    PhaseTimer(ConversionStats* stats_, Phase phase_) noexcept
+        : stats(stats_)
+        , phase(phase_)
+    {
+        if (stats) since = clock::now();
+    }
+
+    PhaseTimer(PhaseTimer const& other) = delete;
+    PhaseTimer& operator=(PhaseTimer const& other) = delete;
+
+    ~PhaseTimer()
+    {
+        Stop();
+    }
+
+    // Count time from now on toward another phase
+    void Switch(Phase next) noexcept
+    {
+        if (!stats) return;
+        auto t = clock::now();
+        times[int(phase)] += t - since;
+        since = t;
+        phase = next;
+    }
+
+    void Stop() noexcept
+    {
+        if (!stats) return;
+        times[int(phase)] += clock::now() - since;
+        for (int p = 0; p < PhaseCount; ++p)
+        {
+            if (times[p].count() != 0) stats->AddTime(Phase(p), times[p]);
+        }
+        stats = nullptr;
+    }
+};
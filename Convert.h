@@ -0,0 +1,192 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "simple_svg_1.0.0.hpp"
+
+#include "RasterImage.h"
+#include "RowSource.h"
+#include "OutputSink.h"
+#include "SvgWriter.h"
+#include "PixelEmitter.h"
+#include "RectMerge.h"
+#include "Palette.h"
+#include "ConversionStats.h"
+#include "ProgressReporter.h"
+#include "ConversionArena.h"
+#include "EnumNameMap.h"
+
+#include <stdint.h>
+#include <string>
+
+// The conversion itself, as a library (raster2vector_core) that works on images in
+// memory and writes to any OutputSink, with every setting in a ConvertOptions, so it
+// can be used without the command line, files or globals:
+//
+//   RasterImage img(pngData, pngSize);
+//   ConvertOptions opts;
+//   opts.merge = MergeMode::regions;
+//   MemoryOutputSink svg;
+//   bool ok = img.Valid() && Convert(img, opts, svg);
+
+// How pixels are combined into shapes:
+// - none: one polygon per pixel
+// - runs: one polygon per horizontal run of identical pixels within a row
+// - blocks: runs of the same color and columns in consecutive rows are merged
+// - rects: greedy decomposition into maximal same-color rectangles
+// - regions: one path per 4-connected same-color region, tracing its pixel edges
+ENUM_WITH_NAME_MAP(MergeMode,
+    none,
+    runs,
+    blocks,
+    rects,
+    regions
+)
+
+// How fill and stroke attributes are shared among shapes:
+// - none: every shape has its own fill and stroke attributes
+// - fill: shapes are grouped by color, in one <g fill> per color
+// - css: shapes name their color with a class defined in a <style> block
+// - path: all shapes of one color are drawn by a single <path> in compact form
+// Except with none, the stroke (if any) is set once, on a group around all shapes.
+ENUM_WITH_NAME_MAP(GroupMode,
+    none,
+    fill,
+    css,
+    path
+)
+
+// Settings of a conversion, with the defaults of the command line options of the same
+// names
+
+struct ConvertOptions
+{
+    double scale = 10.0;
+    double strokeWidth = 0.01;        // 0 for no strokes
+    MergeMode merge = MergeMode::none;
+    GroupMode group = GroupMode::none;
+    int maxColors = 0;                // Reduce to at most this many colors, or 0 to keep them all
+    bool autoBackground = false;      // Draw the most frequent color once, behind the shapes
+    int threads = 1;
+};
+
+inline svg::Layout LayoutFor(ConvertOptions const& opts, int width, int height)
+{
+    using namespace svg;
+
+    Dimensions dimensions(
+        opts.scale * width,
+        opts.scale * height);
+    return Layout(dimensions, Layout::TopLeft, opts.scale);
+}
+
+// Modes that need only a few rows of the image at a time
+inline bool IsStreamable(ConvertOptions const& opts) noexcept
+{
+    return opts.group == GroupMode::none
+        && opts.maxColors == 0
+        && !opts.autoBackground
+        && (opts.merge == MergeMode::none || opts.merge == MergeMode::runs);
+}
+
+inline ShapeStyle StyleForGroupMode(ConvertOptions const& opts) noexcept
+{
+    return
+        opts.group == GroupMode::none ? ShapeStyle::inlined :
+        opts.group == GroupMode::css  ? ShapeStyle::classed :
+        ShapeStyle::grouped;
+}
+
+// Colors shared by several SVG files, such as the frames of an animation.  With --group
+// css, the files all link to one style sheet, with a class for each color of the
+// palette, instead of each having its own.
+
+struct SharedStyles
+{
+    Palette palette;
+    std::string styleSheet; // URL of the style sheet, relative to the SVG files
+};
+
+// Serialize the polygons of one row of pixels in a streamable mode, given the row's
+// pixels and their colors, returning how many there are
+
+template <int Channels>
+uint64_t EmitStreamedRow(PixelEmitter const& emitter, MergeMode merge, RasterImage::PixData_t const* row,
+    RasterImage::RGBA const* colors, int r, int width, TextBuffer& text)
+{
+    uint64_t elements = 0;
+    if (merge == MergeMode::runs)
+    {
+        ForEachRun<Channels>(row, width, [&](int colBegin, int colEnd)
+        {
+            if (!PixelEmitter::IsVisible(colors[colBegin])) return;
+            emitter.EmitRect(text, colBegin, r, colEnd - colBegin, 1, colors[colBegin]);
+            ++elements;
+        });
+    }
+    else
+    {
+        for (int c = 0; c < width; ++c)
+        {
+            if (!PixelEmitter::IsVisible(colors[c])) continue;
+            emitter.EmitRect(text, c, r, 1, 1, colors[c]);
+            ++elements;
+        }
+    }
+    return elements;
+}
+
+// Size of an image's SVG, worked out without writing any of it.  In streamable modes,
+// one pass over the pixels finds the runs, and adds up the lengths they'd be formatted
+// with, which costs far less than converting.  In the others, the size depends on the
+// shapes that mode merges and on how they're grouped, so the image is converted, into
+// a sink that only counts bytes, which costs about as much as converting.  Either way,
+// the counts are exact.
+
+struct OutputEstimate
+{
+    uint64_t elements = 0; // SVG shape elements
+    uint64_t bytes = 0;    // Uncompressed SVG
+    size_t bandBytes = 0;  // Largest band of streamed output, see RowsPerBand(), in streamable modes
+};
+
+// Work out the output for an image in memory
+
+bool EstimateOutput(RasterImage const& img, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress = nullptr);
+
+// Work out the output for the image read from "source".  Every row is read, so a file
+// source can't be converted afterward, but its Reopen() can.  In modes that aren't
+// streamable, the whole image is read into memory.
+
+bool EstimateOutput(RasterRowSource& source, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress = nullptr);
+
+// Convert pixels to polygons, one per pixel or per run of identical pixels in a row, in
+// a streamable mode, reading the image a band of rows at a time.  Given an estimate,
+// the band buffers start out big enough for any band.
+
+bool StreamPixelsToSvg(RasterRowSource& source, SvgWriter& doc, ConvertOptions const& opts, ConversionStats* stats = nullptr,
+    ProgressReporter* progress = nullptr, OutputEstimate const* estimate = nullptr);
+
+// Convert pixels to shapes in any mode, with the whole image in memory.  Given shared
+// styles, every color of the image must be in their palette.  Given an arena, shapes
+// are allocated from it, and stay there until it's released or begins the next image.
+
+bool RasterPixelsToSvg(RasterImage const& img, SvgWriter& doc, ConvertOptions const& opts, ConversionStats* stats = nullptr,
+    ProgressReporter* progress = nullptr, SharedStyles const* styles = nullptr, ConversionArena* arena = nullptr);
+
+// Convert an image in memory, writing the SVG to "sink", and closing it.  Given its
+// estimate, from EstimateOutput(), space for the output is set aside up front, and in
+// streamable modes, the band buffers start out big enough for any band.  Given
+// an arena, its memory is reused for the image's shapes, as converting a series of
+// images on one thread can.
+
+bool Convert(RasterImage const& img, ConvertOptions const& opts, OutputSink& sink, ConversionStats* stats = nullptr,
+    OutputEstimate const* estimate = nullptr, ConversionArena* arena = nullptr);
@@ -0,0 +1,528 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Deflate (RFC 1951) compression of independent chunks of data, each ending in a sync
+// point so the compressed chunks can be concatenated into one stream.  Matches are
+// found with hash chains and lazy matching, like zlib, and coded in blocks with
+// Huffman codes built for each block, falling back to stored blocks for data that
+// doesn't compress.
+
+namespace deflate
+{
+    constexpr int WindowSize = 32768;
+    constexpr int MinMatch = 3;
+    constexpr int MaxMatch = 258;
+    constexpr int HashBits = 15;
+
+    // Effort settings: how many earlier positions to try for a match, the match length
+    // that is good enough to stop looking, and the length past which the next position
+    // isn't tried for a longer match
+    constexpr int MaxChain = 32;
+    constexpr int NiceLength = 128;
+    constexpr int LazyLength = 16;
+
+    constexpr int MaxBlockSymbols = 1 << 15;
+    constexpr int LitLenCodes = 286;
+    constexpr int DistCodes = 30;
+    constexpr int CodeLengthCodes = 19;
+    constexpr int EndOfBlock = 256;
+
+    constexpr uint16_t lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    constexpr uint8_t lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    constexpr uint16_t distBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577 };
+    constexpr uint8_t distExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr uint8_t codeLengthOrder[CodeLengthCodes] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // Length and distance codes (less 257 for lengths) by value.  Distances over 256
+    // share codes in groups of 128, so those are looked up by (distance - 1) >> 7.
+    struct CodeTables
+    {
+        uint8_t lengthCode[MaxMatch + 1];
+        uint8_t distCodeLow[256];
+        uint8_t distCodeHigh[256];
+
+        constexpr CodeTables() : lengthCode(), distCodeLow(), distCodeHigh()
+        {
+            for (int c = 0; c < 29; ++c)
+            {
+                for (int len = lengthBase[c]; len < lengthBase[c] + (1 << lengthExtra[c]) && len <= MaxMatch; ++len)
+                {
+                    lengthCode[len] = uint8_t(c);
+                }
+            }
+            for (int c = 0; c < 30; ++c)
+            {
+                int end = distBase[c] + (1 << distExtra[c]);
+                for (int dist = distBase[c]; dist < end; dist += dist <= 256 ? 1 : 128)
+                {
+                    if (dist <= 256)
+                        distCodeLow[dist - 1] = uint8_t(c);
+                    else
+                        distCodeHigh[(dist - 1) >> 7] = uint8_t(c);
+                }
+            }
+        }
+
+        int DistCode(int dist) const noexcept
+        {
+            return dist <= 256 ? distCodeLow[dist - 1] : distCodeHigh[(dist - 1) >> 7];
+        }
+    };
+
+    inline constexpr CodeTables codeTables;
+
+    // Writes bits least significant first, as deflate packs them
+    class BitWriter
+    {
+        std::vector<unsigned char>& out;
+        uint64_t bits = 0;
+        int bitCount = 0;
+
+    public:
+        BitWriter(std::vector<unsigned char>& out_) : out(out_) {}
+
+        void Put(uint32_t value, int count)
+        {
+            bits |= uint64_t(value) << bitCount;
+            bitCount += count;
+            while (bitCount >= 8)
+            {
+                out.push_back((unsigned char)bits);
+                bits >>= 8;
+                bitCount -= 8;
+            }
+        }
+
+        void AlignToByte()
+        {
+            if (bitCount > 0) Put(0, 8 - bitCount);
+        }
+    };
+
+    // Code lengths, none over maxBits, for symbols used freqs[i] times (0 if unused).
+    // The Huffman tree is built with two queues from symbols sorted by frequency, and
+    // lengths over the limit are moved down while keeping the code complete, as miniz
+    // does.  At least two symbols always get codes, since a code with one is incomplete.
+
+    inline void BuildCodeLengths(uint32_t const* freqs, int symbolCount, int maxBits, uint8_t* lengths)
+    {
+        std::fill(lengths, lengths + symbolCount, uint8_t(0));
+
+        std::vector<int> symbols;
+        for (int i = 0; i < symbolCount; ++i)
+        {
+            if (freqs[i] != 0) symbols.push_back(i);
+        }
+        if (symbols.size() < 2)
+        {
+            int used = symbols.empty() ? 0 : symbols[0];
+            lengths[used] = 1;
+            lengths[used == 0 ? 1 : 0] = 1;
+            return;
+        }
+
+        std::sort(symbols.begin(), symbols.end(), [&](int a, int b)
+        {
+            return freqs[a] != freqs[b] ? freqs[a] < freqs[b] : a < b;
+        });
+
+        // Leaves are nodes [0, n), in increasing weight, and internal nodes are made in
+        // increasing weight after them, so the two lightest are always at a queue front
+        int const n = int(symbols.size());
+        std::vector<uint64_t> weight(2 * n - 1);
+        std::vector<int> parent(2 * n - 1);
+        for (int i = 0; i < n; ++i)
+        {
+            weight[i] = freqs[symbols[i]];
+        }
+
+        int nextLeaf = 0;
+        int nextNode = n;
+        for (int node = n; node < 2 * n - 1; ++node)
+        {
+            auto lightest = [&]
+            {
+                bool takeLeaf = nextLeaf < n && (nextNode >= node || weight[nextLeaf] <= weight[nextNode]);
+                return takeLeaf ? nextLeaf++ : nextNode++;
+            };
+            int a = lightest();
+            int b = lightest();
+            weight[node] = weight[a] + weight[b];
+            parent[a] = parent[b] = node;
+        }
+
+        // Parents come after their children, so depths can be found from the root down
+        std::vector<int> depth(2 * n - 1, 0);
+        int lengthCounts[16] = {};
+        for (int i = 2 * n - 3; i >= 0; --i)
+        {
+            depth[i] = depth[parent[i]] + 1;
+            if (i < n) ++lengthCounts[std::min(depth[i], maxBits)];
+        }
+
+        uint32_t total = 0;
+        for (int len = 1; len <= maxBits; ++len)
+        {
+            total += uint32_t(lengthCounts[len]) << (maxBits - len);
+        }
+        while (total > (1u << maxBits))
+        {
+            --lengthCounts[maxBits];
+            for (int len = maxBits - 1; len > 0; --len)
+            {
+                if (lengthCounts[len] != 0)
+                {
+                    --lengthCounts[len];
+                    lengthCounts[len + 1] += 2;
+                    break;
+                }
+            }
+            --total;
+        }
+
+        // Least frequent symbols get the longest codes
+        int i = 0;
+        for (int len = maxBits; len > 0; --len)
+        {
+            for (int k = 0; k < lengthCounts[len]; ++k)
+            {
+                lengths[symbols[i++]] = uint8_t(len);
+            }
+        }
+    }
+
+    // Canonical codes for the given code lengths, bit-reversed for BitWriter
+    inline void BuildCodes(uint8_t const* lengths, int symbolCount, uint16_t* codes)
+    {
+        int lengthCounts[16] = {};
+        for (int i = 0; i < symbolCount; ++i)
+        {
+            ++lengthCounts[lengths[i]];
+        }
+        lengthCounts[0] = 0;
+
+        int nextCode[16] = {};
+        for (int len = 1, code = 0; len < 16; ++len)
+        {
+            code = (code + lengthCounts[len - 1]) << 1;
+            nextCode[len] = code;
+        }
+
+        for (int i = 0; i < symbolCount; ++i)
+        {
+            int len = lengths[i];
+            uint32_t code = len ? nextCode[len]++ : 0;
+            uint32_t reversed = 0;
+            for (int b = 0; b < len; ++b, code >>= 1)
+            {
+                reversed = (reversed << 1) | (code & 1);
+            }
+            codes[i] = uint16_t(reversed);
+        }
+    }
+
+    // A literal (dist 0) or a match
+    struct Symbol
+    {
+        uint16_t value;  // Literal byte or match length
+        uint16_t dist;
+    };
+
+    inline void WriteStoredBlocks(BitWriter& bits, std::vector<unsigned char>& out, unsigned char const* data, size_t size)
+    {
+        do
+        {
+            size_t blockSize = std::min<size_t>(size, 65535);
+            bits.Put(0, 3);  // BFINAL = 0, BTYPE = 0
+            bits.AlignToByte();
+            bits.Put(uint32_t(blockSize), 16);
+            bits.Put(uint32_t(~blockSize & 0xFFFF), 16);
+            out.insert(out.end(), data, data + blockSize);
+            data += blockSize;
+            size -= blockSize;
+        } while (size > 0);
+    }
+
+    // Write one non-final block coding the symbols, which cover "size" bytes of data,
+    // with dynamic Huffman codes, or as stored blocks if that is smaller
+    inline void WriteBlock(BitWriter& bits, std::vector<unsigned char>& out,
+        std::vector<Symbol> const& symbols, unsigned char const* data, size_t size)
+    {
+        uint32_t litFreqs[LitLenCodes] = {};
+        uint32_t distFreqs[DistCodes] = {};
+        for (Symbol s : symbols)
+        {
+            if (s.dist == 0)
+            {
+                ++litFreqs[s.value];
+            }
+            else
+            {
+                ++litFreqs[257 + codeTables.lengthCode[s.value]];
+                ++distFreqs[codeTables.DistCode(s.dist)];
+            }
+        }
+        litFreqs[EndOfBlock] = 1;
+
+        uint8_t litLengths[LitLenCodes];
+        uint8_t distLengths[DistCodes];
+        BuildCodeLengths(litFreqs, LitLenCodes, 15, litLengths);
+        BuildCodeLengths(distFreqs, DistCodes, 15, distLengths);
+
+        int litCount = LitLenCodes;
+        while (litCount > 257 && litLengths[litCount - 1] == 0) --litCount;
+        int distCount = DistCodes;
+        while (distCount > 1 && distLengths[distCount - 1] == 0) --distCount;
+
+        // Run-length code both sets of code lengths together: 16 repeats the previous
+        // length 3-6 times, 17 and 18 give 3-10 and 11-138 zeros
+        uint8_t allLengths[LitLenCodes + DistCodes];
+        std::copy(litLengths, litLengths + litCount, allLengths);
+        std::copy(distLengths, distLengths + distCount, allLengths + litCount);
+        int const lengthCount = litCount + distCount;
+
+        struct LengthSymbol { uint8_t code; uint8_t extra; };
+        std::vector<LengthSymbol> lengthSymbols;
+        uint32_t lengthFreqs[CodeLengthCodes] = {};
+        auto addLength = [&](int code, int extra)
+        {
+            lengthSymbols.push_back(LengthSymbol{uint8_t(code), uint8_t(extra)});
+            ++lengthFreqs[code];
+        };
+
+        for (int i = 0; i < lengthCount; )
+        {
+            int len = allLengths[i];
+            int run = 1;
+            while (i + run < lengthCount && allLengths[i + run] == len) ++run;
+            i += run;
+
+            if (len == 0)
+            {
+                for (; run >= 11; run -= std::min(run, 138)) addLength(18, std::min(run, 138) - 11);
+                if (run >= 3)
+                {
+                    addLength(17, run - 3);
+                    run = 0;
+                }
+            }
+            else
+            {
+                addLength(len, 0);
+                --run;
+                for (; run >= 3; run -= std::min(run, 6)) addLength(16, std::min(run, 6) - 3);
+            }
+            for (; run > 0; --run) addLength(len, 0);
+        }
+
+        uint8_t codeLengthLengths[CodeLengthCodes];
+        BuildCodeLengths(lengthFreqs, CodeLengthCodes, 7, codeLengthLengths);
+        int codeLengthCount = CodeLengthCodes;
+        while (codeLengthCount > 4 && codeLengthLengths[codeLengthOrder[codeLengthCount - 1]] == 0) --codeLengthCount;
+
+        // Compare sizes in bits
+        static constexpr int lengthSymbolExtra[CodeLengthCodes] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+        uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * uint64_t(codeLengthCount);
+        for (int c = 0; c < CodeLengthCodes; ++c)
+        {
+            dynamicBits += uint64_t(lengthFreqs[c]) * (codeLengthLengths[c] + lengthSymbolExtra[c]);
+        }
+        for (int c = 0; c < LitLenCodes; ++c)
+        {
+            dynamicBits += uint64_t(litFreqs[c]) * (litLengths[c] + (c > 256 ? lengthExtra[c - 257] : 0));
+        }
+        for (int c = 0; c < DistCodes; ++c)
+        {
+            dynamicBits += uint64_t(distFreqs[c]) * (distLengths[c] + distExtra[c]);
+        }
+
+        uint64_t storedBits = (uint64_t(size) + 5 * ((size + 65534) / 65535 + 1)) * 8;
+        if (storedBits < dynamicBits)
+        {
+            WriteStoredBlocks(bits, out, data, size);
+            return;
+        }
+
+        uint16_t litCodes[LitLenCodes];
+        uint16_t distCodes[DistCodes];
+        uint16_t codeLengthCodes[CodeLengthCodes];
+        BuildCodes(litLengths, LitLenCodes, litCodes);
+        BuildCodes(distLengths, DistCodes, distCodes);
+        BuildCodes(codeLengthLengths, CodeLengthCodes, codeLengthCodes);
+
+        bits.Put(2 << 1, 3);  // BFINAL = 0, BTYPE = 2
+        bits.Put(litCount - 257, 5);
+        bits.Put(distCount - 1, 5);
+        bits.Put(codeLengthCount - 4, 4);
+        for (int i = 0; i < codeLengthCount; ++i)
+        {
+            bits.Put(codeLengthLengths[codeLengthOrder[i]], 3);
+        }
+        for (LengthSymbol s : lengthSymbols)
+        {
+            bits.Put(codeLengthCodes[s.code], codeLengthLengths[s.code]);
+            if (s.code >= 16) bits.Put(s.extra, lengthSymbolExtra[s.code]);
+        }
+
+        for (Symbol s : symbols)
+        {
+            if (s.dist == 0)
+            {
+                bits.Put(litCodes[s.value], litLengths[s.value]);
+                continue;
+            }
+
+            int lc = codeTables.lengthCode[s.value];
+            bits.Put(litCodes[257 + lc], litLengths[257 + lc]);
+            bits.Put(s.value - lengthBase[lc], lengthExtra[lc]);
+
+            int dc = codeTables.DistCode(s.dist);
+            bits.Put(distCodes[dc], distLengths[dc]);
+            bits.Put(s.dist - distBase[dc], distExtra[dc]);
+        }
+        bits.Put(litCodes[EndOfBlock], litLengths[EndOfBlock]);
+    }
+}
+
+// Append the deflated data to "out" as non-final blocks, ending with an empty stored
+// block that brings the output to a byte boundary (a sync flush, in zlib terms).
+// Matches never reach before the data, so chunks deflated separately, even at the same
+// time, can be concatenated in order; a final block must follow the last.
+
+inline void DeflateChunk(unsigned char const* data, size_t size, std::vector<unsigned char>& out)
+{
+    using namespace deflate;
+
+    deflate::BitWriter bits(out);
+    std::vector<Symbol> symbols;
+    symbols.reserve(MaxBlockSymbols);
+    size_t blockStart = 0;
+
+    // Most recent position by hash of the 3 bytes there, and for each position in the
+    // window, the previous position with the same hash
+    std::vector<int32_t> head(size_t(1) << HashBits, -1);
+    std::vector<int32_t> prev(WindowSize, -1);
+
+    auto hashAt = [&](size_t i)
+    {
+        uint32_t v = uint32_t(data[i]) | (uint32_t(data[i + 1]) << 8) | (uint32_t(data[i + 2]) << 16);
+        return (v * 2654435761u) >> (32 - HashBits);
+    };
+
+    auto insert = [&](size_t i)
+    {
+        if (i + MinMatch > size) return;
+        uint32_t h = hashAt(i);
+        prev[i & (WindowSize - 1)] = head[h];
+        head[h] = int32_t(i);
+    };
+
+    // Longest match for position i among earlier positions not yet inserted past
+    auto longestMatch = [&](size_t i, int& bestDist)
+    {
+        int limit = int(std::min<size_t>(MaxMatch, size - i));
+        if (limit < MinMatch) return 0;
+
+        int best = MinMatch - 1;
+        int32_t candidate = head[hashAt(i)];
+        for (int chain = MaxChain; candidate >= 0 && i - candidate <= WindowSize && chain > 0; --chain)
+        {
+            unsigned char const* a = data + candidate;
+            unsigned char const* b = data + i;
+            if (a[best] == b[best] && a[0] == b[0])
+            {
+                int len = 1;
+                while (len < limit && a[len] == b[len]) ++len;
+                if (len > best)
+                {
+                    best = len;
+                    bestDist = int(i - candidate);
+                    if (len >= NiceLength || len == limit) break;
+                }
+            }
+
+            int32_t next = prev[candidate & (WindowSize - 1)];
+            if (next >= candidate) break;  // Slot reused by a newer position
+            candidate = next;
+        }
+        return best >= MinMatch ? best : 0;
+    };
+
+    auto endBlock = [&](size_t end)
+    {
+        if (symbols.empty()) return;
+        WriteBlock(bits, out, symbols, data + blockStart, end - blockStart);
+        symbols.clear();
+        blockStart = end;
+    };
+
+    size_t i = 0;
+    int len = 0;
+    int dist = 0;
+    bool matchKnown = false;
+    while (i < size)
+    {
+        if (symbols.size() >= MaxBlockSymbols) endBlock(i);
+
+        if (!matchKnown) len = longestMatch(i, dist);
+        matchKnown = false;
+        insert(i);
+
+        // If the next position has a longer match, take this byte as a literal instead
+        if (len != 0 && len < LazyLength)
+        {
+            int nextDist = 0;
+            int nextLen = longestMatch(i + 1, nextDist);
+            if (nextLen > len)
+            {
+                symbols.push_back(Symbol{data[i], 0});
+                ++i;
+                len = nextLen;
+                dist = nextDist;
+                matchKnown = true;
+                continue;
+            }
+        }
+
+        if (len != 0)
+        {
+            symbols.push_back(Symbol{uint16_t(len), uint16_t(dist)});
+            for (int k = 1; k < len; ++k)
+            {
+                insert(i + k);
+            }
+            i += len;
+        }
+        else
+        {
+            symbols.push_back(Symbol{data[i], 0});
+            ++i;
+        }
+    }
+    endBlock(size);
+
+    // Empty stored block
+    bits.Put(0, 3);
+    bits.AlignToByte();
+    bits.Put(0xFFFF0000u, 32);
+}
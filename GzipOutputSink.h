@@ -0,0 +1,311 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "Deflate.h"
+#include "OutputSink.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// CRC-32 as used by gzip, with a table built at compile time
+
+struct Crc32Table
+{
+    uint32_t entries[256];
+
+    constexpr Crc32Table() : entries()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+inline constexpr Crc32Table g_crc32Table;
+
+inline uint32_t Crc32(uint32_t crc, unsigned char const* data, size_t size) noexcept
+{
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = g_crc32Table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// CRC-32 of two blocks of data put together, from the CRC of each and the size of the
+// second, so blocks can be checksummed separately.  Appending size2 zero bytes is a
+// linear operator on the CRC, applied by repeated squaring of its 32x32 bit matrix
+// (the method of zlib's crc32_combine).
+
+inline uint32_t Crc32Combine(uint32_t crc1, uint32_t crc2, uint64_t size2) noexcept
+{
+    auto times = [](uint32_t const* matrix, uint32_t vec)
+    {
+        uint32_t sum = 0;
+        for (; vec; vec >>= 1, ++matrix)
+        {
+            if (vec & 1) sum ^= *matrix;
+        }
+        return sum;
+    };
+
+    auto square = [&](uint32_t* result, uint32_t const* matrix)
+    {
+        for (int n = 0; n < 32; ++n)
+        {
+            result[n] = times(matrix, matrix[n]);
+        }
+    };
+
+    if (size2 == 0) return crc1;
+
+    // Operator for one zero bit, then two, then four
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = 0xEDB88320u;
+    for (int n = 1; n < 32; ++n)
+    {
+        odd[n] = 1u << (n - 1);
+    }
+    square(even, odd);
+    square(odd, even);
+
+    // Each pass squares the operator to the next power of two bytes
+    while (true)
+    {
+        square(even, odd);
+        if (size2 & 1) crc1 = times(even, crc1);
+        size2 >>= 1;
+        if (size2 == 0) break;
+
+        square(odd, even);
+        if (size2 & 1) crc1 = times(odd, crc1);
+        size2 >>= 1;
+        if (size2 == 0) break;
+    }
+
+    return crc1 ^ crc2;
+}
+
+// Output sink compressing everything written to it into a gzip stream on another sink.
+// Data is split into chunks that are deflated independently, on a pool of threads if
+// threadCount is more than 1, and written in order as they finish (like pigz).  Each
+// chunk ends in a sync point, so they can simply be concatenated, with an empty final
+// block after the last.  A chunk can't refer back into the one before it, which costs
+// little at this chunk size.
+
+class GzipOutputSink : public OutputSink
+{
+public:
+    static constexpr size_t DefaultChunkSize = 256 << 10;
+
+private:
+    struct Chunk
+    {
+        std::vector<unsigned char> input;
+        std::vector<unsigned char> deflated;
+        uint32_t crc = 0;
+        bool done = false;
+    };
+
+    OutputSink& out;
+    size_t chunkSize;
+    std::unique_ptr<Chunk> filling;
+
+    // Chunks submitted but not yet written, in order, and those of them not yet taken
+    // by a worker.  At most maxPending chunks are in flight, bounding memory use.
+    std::deque<std::unique_ptr<Chunk>> pending;
+    std::deque<Chunk*> toDeflate;
+    size_t maxPending;
+
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable chunkDone;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    bool ok;
+    bool closed = false;
+    uint32_t crc = 0;
+    uint64_t totalSize = 0;
+
+public:
+    GzipOutputSink(OutputSink& out_, int threadCount, size_t chunkSize_ = DefaultChunkSize)
+        : out(out_)
+        , chunkSize(chunkSize_)
+        , filling(NewChunk())
+        , maxPending(2 * size_t(std::max(1, threadCount)))
+    {
+        // ID, deflate, no flags, no time stamp, no extra flags, unknown OS
+        static unsigned char const header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+        ok = out.Write(reinterpret_cast<char const*>(header), sizeof(header));
+
+        if (threadCount > 1)
+        {
+            workers.reserve(threadCount);
+            for (int t = 0; t < threadCount; ++t)
+            {
+                workers.emplace_back([this] { Work(); });
+            }
+        }
+    }
+
+    ~GzipOutputSink()
+    {
+        StopWorkers();
+    }
+
+    using OutputSink::Write;
+
+    bool Write(char const* data, size_t size) override
+    {
+        while (ok && size > 0)
+        {
+            size_t n = std::min(size, chunkSize - filling->input.size());
+            filling->input.insert(filling->input.end(), data, data + n);
+            data += n;
+            size -= n;
+
+            if (filling->input.size() == chunkSize) Submit();
+        }
+        return ok;
+    }
+
+    bool Close() override
+    {
+        if (closed) return false;
+        closed = true;
+
+        if (!filling->input.empty()) Submit();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            WriteFinished(lock, 0);
+        }
+        StopWorkers();
+
+        // Empty final stored block, then the CRC and size of the uncompressed data
+        unsigned char trailer[13] = {1, 0, 0, 0xFF, 0xFF};
+        for (int i = 0; i < 4; ++i)
+        {
+            trailer[5 + i] = (unsigned char)(crc >> (8 * i));
+            trailer[9 + i] = (unsigned char)(totalSize >> (8 * i));
+        }
+        ok = ok && out.Write(reinterpret_cast<char const*>(trailer), sizeof(trailer));
+
+        return out.Close() && ok;
+    }
+
+private:
+    std::unique_ptr<Chunk> NewChunk()
+    {
+        auto chunk = std::make_unique<Chunk>();
+        chunk->input.reserve(chunkSize);
+        return chunk;
+    }
+
+    static void Deflate(Chunk& chunk)
+    {
+        chunk.crc = Crc32(0, chunk.input.data(), chunk.input.size());
+        DeflateChunk(chunk.input.data(), chunk.input.size(), chunk.deflated);
+    }
+
+    void WriteChunk(Chunk const& chunk)
+    {
+        ok = ok && out.Write(reinterpret_cast<char const*>(chunk.deflated.data()), chunk.deflated.size());
+        crc = Crc32Combine(crc, chunk.crc, chunk.input.size());
+        totalSize += chunk.input.size();
+    }
+
+    // Hand the filled chunk off to be deflated, and start a new one
+    void Submit()
+    {
+        std::unique_ptr<Chunk> chunk = std::move(filling);
+        filling = NewChunk();
+
+        if (workers.empty())
+        {
+            Deflate(*chunk);
+            WriteChunk(*chunk);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        toDeflate.push_back(chunk.get());
+        pending.push_back(std::move(chunk));
+        workReady.notify_one();
+        WriteFinished(lock, maxPending);
+    }
+
+    // Write out finished chunks in order, waiting for more to finish while over the limit
+    void WriteFinished(std::unique_lock<std::mutex>& lock, size_t limit)
+    {
+        while (!pending.empty())
+        {
+            if (!pending.front()->done)
+            {
+                if (pending.size() <= limit) return;
+                chunkDone.wait(lock);
+                continue;
+            }
+
+            std::unique_ptr<Chunk> chunk = std::move(pending.front());
+            pending.pop_front();
+            lock.unlock();
+            WriteChunk(*chunk);
+            lock.lock();
+        }
+    }
+
+    void Work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            workReady.wait(lock, [this] { return stopping || !toDeflate.empty(); });
+            if (stopping) return;
+
+            Chunk* chunk = toDeflate.front();
+            toDeflate.pop_front();
+            lock.unlock();
+            Deflate(*chunk);
+            lock.lock();
+
+            chunk->done = true;
+            chunkDone.notify_one();
+        }
+    }
+
+    void StopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workReady.notify_all();
+        for (auto& t : workers)
+        {
+            t.join();
+        }
+        workers.clear();
+    }
+};
@@ -0,0 +1,62 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Comparisons of two versions of an image, to find what needs converting again.  Rows
+// are compared with memcmp, which the C library vectorizes, so a diff runs at about
+// the speed of memory.
+
+// Images of the same size and pixel format, so their pixels can be compared directly
+inline bool SameLayout(RasterImage const& a, RasterImage const& b) noexcept
+{
+    return a.Valid() && b.Valid()
+        && a.Width() == b.Width() && a.Height() == b.Height() && a.ChannelCount() == b.ChannelCount();
+}
+
+// For each row of two images with the same layout, 1 if any pixel of it differs
+inline std::vector<uint8_t> ChangedRows(RasterImage const& a, RasterImage const& b)
+{
+    std::vector<uint8_t> changed(a.Height());
+    size_t const rowSize = a.RowSizeInBytes();
+    for (int r = 0; r < a.Height(); ++r)
+    {
+        changed[r] = memcmp(a.Pixel(r, 0), b.Pixel(r, 0), rowSize) != 0;
+    }
+    return changed;
+}
+
+// Whether any pixel differs within a rectangle of two images with the same layout
+inline bool RectChanged(RasterImage const& a, RasterImage const& b, int x, int y, int w, int h) noexcept
+{
+    size_t const size = size_t(w) * a.ChannelCount();
+    for (int r = y; r < y + h; ++r)
+    {
+        if (memcmp(a.Pixel(r, x), b.Pixel(r, x), size) != 0) return true;
+    }
+    return false;
+}
+
+// Whether a w x h rectangle at (ax, ay) in one image has the same pixels as one at
+// (bx, by) in another, for telling apart images whose hashes match
+inline bool SameRect(RasterImage const& a, int ax, int ay, RasterImage const& b, int bx, int by, int w, int h) noexcept
+{
+    if (a.ChannelCount() != b.ChannelCount()) return false;
+    size_t const size = size_t(w) * a.ChannelCount();
+    for (int r = 0; r < h; ++r)
+    {
+        if (memcmp(a.Pixel(ay + r, ax), b.Pixel(by + r, bx), size) != 0) return false;
+    }
+    return true;
+}
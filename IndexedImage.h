@@ -0,0 +1,210 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+#include "Palette.h"
+#include "Quantize.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Image whose pixels are indices into a palette of colors, numbered in raster order of
+// first appearance.  Indices are stored as a RasterImage with one channel, for up to
+// 256 colors, or two channels holding the low and high bytes, for up to 65536.  Two
+// pixels have the same color exactly when their indices are equal, so stages that only
+// compare pixels (all the merge stages) work on Indices() unchanged, with a quarter of
+// the memory traffic of RGBA or less.
+
+class IndexedImage
+{
+    RasterImage indices;
+    Palette palette;
+    std::vector<uint64_t> pixelCounts; // By palette index
+
+public:
+    static constexpr size_t MaxColors = 65536;
+
+    bool Valid() const noexcept { return indices.Valid(); }
+
+    RasterImage const& Indices() const noexcept { return indices; }
+    Palette const& GetPalette() const noexcept { return palette; }
+
+    uint32_t IndexAt(int row, int col) const noexcept
+    {
+        auto const* p = indices.Pixel(row, col);
+        return indices.ChannelCount() == 1 ? p[0] : uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+    }
+
+    RasterImage::RGBA ColorAt(int row, int col) const noexcept
+    {
+        return palette.Color(IndexAt(row, col));
+    }
+
+    // Number of pixels of a palette color
+    uint64_t PixelCount(uint32_t index) const noexcept { return pixelCounts[index]; }
+
+    // Index the colors of an image.  If maxColors isn't 0, colors are first reduced to at
+    // most that many (and no more than MaxColors) by median cut.  Otherwise, the result
+    // is invalid if the image has more than MaxColors colors.
+
+    static IndexedImage FromImage(RasterImage const& img, size_t maxColors)
+    {
+        using RGBA = RasterImage::RGBA;
+
+        int const width = img.Width();
+        int const height = img.Height();
+        size_t const colorLimit = maxColors == 0 ? MaxColors : std::min(maxColors, MaxColors);
+
+        IndexedImage result;
+        if (!img.Valid()) return result;
+
+        // Call visit(col, color) for each run of identical pixels in a row
+        std::vector<RGBA> rowColors(width);
+        auto forEachRun = [&](int row, auto&& visit)
+        {
+            img.GetRowRGBA(row, rowColors.data());
+            uint32_t prevKey = 0;
+            for (int col = 0; col < width; ++col)
+            {
+                uint32_t key = Palette::Key(rowColors[col]);
+                if (col == 0 || key != prevKey) visit(col, rowColors[col]);
+                prevKey = key;
+            }
+        };
+
+        // Find every distinct color and how many pixels use it.  The palette only gets
+        // this big if the colors will be reduced.
+        Palette all;
+        std::vector<uint64_t> counts;
+        for (int row = 0; row < height; ++row)
+        {
+            int runCol = 0;
+            uint32_t runIndex = 0;
+            auto endRun = [&](int col)
+            {
+                if (col > runCol) counts[runIndex] += uint64_t(col - runCol);
+            };
+
+            forEachRun(row, [&](int col, RGBA color)
+            {
+                if (col > 0) endRun(col);
+                runCol = col;
+                runIndex = all.Add(color);
+                if (runIndex == counts.size()) counts.push_back(0);
+            });
+            endRun(width);
+
+            if (maxColors == 0 && all.Size() > MaxColors) return result;
+        }
+
+        // Without reduction, each color represents itself
+        std::vector<RGBA> reduced;
+        std::vector<uint32_t> representative;
+        if (all.Size() > colorLimit)
+        {
+            std::vector<RGBA> colors(all.Size());
+            for (uint32_t i = 0; i < colors.size(); ++i)
+            {
+                colors[i] = all.Color(i);
+            }
+            representative = MedianCut(colors, counts, colorLimit, reduced);
+        }
+        else
+        {
+            representative.resize(all.Size());
+            reduced.resize(all.Size());
+            for (uint32_t i = 0; i < representative.size(); ++i)
+            {
+                representative[i] = i;
+                reduced[i] = all.Color(i);
+            }
+        }
+
+        // Number the final colors in raster order of first appearance
+        std::vector<uint32_t> finalIndex(reduced.size(), UINT32_MAX);
+        int channels = reduced.size() <= 256 ? 1 : 2;
+        RasterImage indices(width, height, channels);
+        if (!indices.Valid()) return result;
+
+        for (int row = 0; row < height; ++row)
+        {
+            auto* out = indices.Pixel(row, 0);
+            uint32_t index = 0;
+            int runCol = 0;
+            auto fill = [&](int colEnd)
+            {
+                for (int col = runCol; col < colEnd; ++col)
+                {
+                    out[col * channels] = RasterImage::PixData_t(index);
+                    if (channels == 2) out[col * channels + 1] = RasterImage::PixData_t(index >> 8);
+                }
+            };
+
+            forEachRun(row, [&](int col, RGBA color)
+            {
+                if (col > 0) fill(col);
+                runCol = col;
+
+                uint32_t r = representative[all.IndexOf(color)];
+                if (finalIndex[r] == UINT32_MAX) finalIndex[r] = result.palette.Add(reduced[r]);
+                index = finalIndex[r];
+            });
+            fill(width);
+        }
+
+        result.pixelCounts.assign(result.palette.Size(), 0);
+        for (uint32_t i = 0; i < counts.size(); ++i)
+        {
+            result.pixelCounts[finalIndex[representative[i]]] += counts[i];
+        }
+
+        result.indices = std::move(indices);
+        return result;
+    }
+};
+
+// Reduce several images of the same size and format to at most maxColors colors in
+// all, by median cut over all of them at once, so that a color is reduced the same way
+// in every image, as the frames of an animation need.  The images are stacked into
+// one, indexed together, and replaced by the reduced colors, in place.
+
+inline bool ReduceColorsTogether(std::vector<RasterImage*> const& images, size_t maxColors)
+{
+    if (images.empty()) return true;
+
+    int const width = images[0]->Width();
+    int const height = images[0]->Height();
+    if (uint64_t(height) * images.size() > uint64_t(INT_MAX)) return false;
+    RasterImage stacked(width, int(height * images.size()), images[0]->ChannelCount());
+    if (!stacked.Valid()) return false;
+
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        memcpy(stacked.Pixel(int(i) * height, 0), images[i]->Pixel(0, 0), images[i]->SizeInBytes());
+    }
+
+    IndexedImage indexed = IndexedImage::FromImage(stacked, maxColors);
+    if (!indexed.Valid()) return false;
+    stacked.Release();
+
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        for (int row = 0; row < height; ++row)
+        {
+            for (int col = 0; col < width; ++col)
+            {
+                images[i]->SetPixelRGBA(row, col, indexed.ColorAt(int(i) * height + row, col));
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,415 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "Deflate.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Streaming decompression of a zlib (RFC 1950) stream of deflated data (RFC 1951), so
+// huge compressed images can be read without holding them in memory.  Compressed data
+// is pulled from a fill function as it's needed, and decompressed data is handed out
+// in pieces of any size, keeping only the 32 KB window that matches can reach back
+// into.  Huffman codes are decoded through a table indexed by their first FastBits
+// bits, and codes longer than that one bit at a time.  Like stb_image, the Adler-32
+// checksum at the end isn't checked.
+
+class Inflater
+{
+public:
+    // Copies up to "size" more bytes of compressed data to "data", returning how many,
+    // or 0 at the end of the data
+    using Fill = std::function<size_t(unsigned char* data, size_t size)>;
+
+private:
+    static constexpr int FastBits = 10;
+    static constexpr int MaxCodeLength = 15;
+    static constexpr int MaxSymbols = 288;
+    static constexpr size_t WindowMask = deflate::WindowSize - 1;
+
+    // Canonical Huffman code, as the number of codes of each length and the symbols in
+    // code order, plus the fast table: length << 9 | symbol for each code of up to
+    // FastBits bits, at every index whose low bits are that code, or 0
+    struct Huffman
+    {
+        uint16_t counts[MaxCodeLength + 1];
+        uint16_t symbols[MaxSymbols];
+        uint16_t fast[1 << FastBits];
+    };
+
+    enum class State
+    {
+        header,
+        blockStart,
+        stored,
+        huffman,
+        done,
+        failed
+    };
+
+    Fill fill;
+    std::vector<unsigned char> input;
+    size_t inputPos = 0;
+    size_t inputEnd = 0;
+
+    // Bits not yet used, least significant first.  Past the end of the input, zeros are
+    // read instead, counted by paddedBits, and using any of them is an error.
+    uint64_t bits = 0;
+    int bitCount = 0;
+    int paddedBits = 0;
+
+    std::vector<unsigned char> window;
+    uint64_t totalOut = 0;
+
+    State state = State::header;
+    bool finalBlock = false;
+    uint32_t storedLeft = 0;
+    int copyLength = 0;
+    int copyDistance = 0;
+    Huffman litLen;
+    Huffman dist;
+    std::string failure;
+
+public:
+    explicit Inflater(Fill fill_)
+        : fill(std::move(fill_))
+        , input(64 << 10)
+        , window(deflate::WindowSize)
+    {
+    }
+
+    bool Failed() const noexcept { return state == State::failed; }
+    std::string const& FailureReason() const noexcept { return failure; }
+
+    // Decompress up to "size" bytes to "out", returning how many.  Fewer than "size"
+    // means the stream ended, or is corrupt if Failed().
+
+    size_t Read(unsigned char* out, size_t size)
+    {
+        using namespace deflate;
+
+        size_t done = 0;
+        auto put = [&](unsigned char byte)
+        {
+            out[done++] = byte;
+            window[totalOut++ & WindowMask] = byte;
+        };
+
+        while (done < size)
+        {
+            if (copyLength > 0)
+            {
+                int n = int(std::min<size_t>(size_t(copyLength), size - done));
+                for (int i = 0; i < n; ++i)
+                {
+                    put(window[(totalOut - uint64_t(copyDistance)) & WindowMask]);
+                }
+                copyLength -= n;
+                continue;
+            }
+
+            switch (state)
+            {
+            case State::header:
+            {
+                uint32_t cmf = GetBits(8);
+                uint32_t flg = GetBits(8);
+                if ((cmf * 256 + flg) % 31 != 0 || (cmf & 15) != 8 || (cmf >> 4) > 7 || (flg & 0x20) != 0)
+                {
+                    return Fail("Not a zlib stream", done);
+                }
+                state = State::blockStart;
+                break;
+            }
+
+            case State::blockStart:
+            {
+                if (finalBlock)
+                {
+                    state = State::done;
+                    return done;
+                }
+                finalBlock = GetBits(1) != 0;
+                uint32_t type = GetBits(2);
+                if (type == 0)
+                {
+                    GetBits(bitCount & 7);
+                    uint32_t length = GetBits(16);
+                    uint32_t inverse = GetBits(16);
+                    if ((length ^ 0xFFFF) != inverse) return Fail("Corrupt stored block", done);
+                    storedLeft = length;
+                    state = State::stored;
+                }
+                else if (type == 1)
+                {
+                    BuildFixedCodes();
+                    state = State::huffman;
+                }
+                else if (type == 2)
+                {
+                    if (!ReadDynamicCodes()) return Fail("Corrupt Huffman codes", done);
+                    state = State::huffman;
+                }
+                else
+                {
+                    return Fail("Corrupt block type", done);
+                }
+                break;
+            }
+
+            case State::stored:
+                if (storedLeft == 0)
+                {
+                    state = State::blockStart;
+                }
+                else
+                {
+                    put((unsigned char)GetBits(8));
+                    --storedLeft;
+                }
+                break;
+
+            case State::huffman:
+            {
+                int symbol = Decode(litLen);
+                if (symbol < 256)
+                {
+                    if (symbol < 0) return Fail("Corrupt compressed data", done);
+                    put((unsigned char)symbol);
+                    break;
+                }
+                if (symbol == EndOfBlock)
+                {
+                    state = State::blockStart;
+                    break;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29) return Fail("Corrupt compressed data", done);
+                int length = lengthBase[symbol] + int(GetBits(lengthExtra[symbol]));
+                int distCode = Decode(dist);
+                if (distCode < 0 || distCode >= DistCodes) return Fail("Corrupt compressed data", done);
+                int distance = distBase[distCode] + int(GetBits(distExtra[distCode]));
+                if (uint64_t(distance) > totalOut) return Fail("Corrupt compressed data", done);
+                copyLength = length;
+                copyDistance = distance;
+                break;
+            }
+
+            case State::done:
+            case State::failed:
+                return done;
+            }
+
+            if (bitCount < paddedBits) return Fail("Compressed data is truncated", done);
+        }
+        return done;
+    }
+
+private:
+    size_t Fail(char const* reason, size_t done)
+    {
+        failure = reason;
+        state = State::failed;
+        return done;
+    }
+
+    uint32_t NextByte()
+    {
+        if (inputPos == inputEnd)
+        {
+            inputPos = 0;
+            inputEnd = fill(input.data(), input.size());
+            if (inputEnd == 0)
+            {
+                paddedBits += 8;
+                return 0;
+            }
+        }
+        return input[inputPos++];
+    }
+
+    void Need(int count)
+    {
+        while (bitCount < count)
+        {
+            bits |= uint64_t(NextByte()) << bitCount;
+            bitCount += 8;
+        }
+    }
+
+    void Consume(int count) noexcept
+    {
+        bits >>= count;
+        bitCount -= count;
+    }
+
+    uint32_t GetBits(int count)
+    {
+        if (count == 0) return 0;
+        Need(count);
+        uint32_t value = uint32_t(bits & ((uint64_t(1) << count) - 1));
+        Consume(count);
+        return value;
+    }
+
+    // Next symbol, or -1 for a code that isn't in the table
+    int Decode(Huffman const& code)
+    {
+        Need(MaxCodeLength);
+        uint16_t entry = code.fast[bits & ((1u << FastBits) - 1)];
+        if (entry != 0)
+        {
+            Consume(entry >> 9);
+            return entry & 511;
+        }
+
+        // Codes of each length are consecutive, and follow those of the previous length
+        int value = 0;
+        int first = 0;
+        int index = 0;
+        for (int length = 1; length <= MaxCodeLength; ++length)
+        {
+            value |= int((bits >> (length - 1)) & 1);
+            int count = code.counts[length];
+            if (value - first < count)
+            {
+                Consume(length);
+                return code.symbols[index + value - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            value <<= 1;
+        }
+        return -1;
+    }
+
+    // Build a code from each symbol's code length, 0 for unused.  A code may be
+    // incomplete, but not use more codes than its lengths allow.
+
+    static bool BuildCode(Huffman& code, uint8_t const* lengths, int symbolCount)
+    {
+        memset(code.counts, 0, sizeof(code.counts));
+        for (int s = 0; s < symbolCount; ++s)
+        {
+            ++code.counts[lengths[s]];
+        }
+        code.counts[0] = 0;
+
+        int left = 1;
+        uint16_t offsets[MaxCodeLength + 2];
+        offsets[1] = 0;
+        for (int length = 1; length <= MaxCodeLength; ++length)
+        {
+            left = (left << 1) - code.counts[length];
+            if (left < 0) return false;
+            offsets[length + 1] = uint16_t(offsets[length] + code.counts[length]);
+        }
+        for (int s = 0; s < symbolCount; ++s)
+        {
+            if (lengths[s] != 0) code.symbols[offsets[lengths[s]]++] = uint16_t(s);
+        }
+
+        // Codes are packed from their most significant bit, so table indexes hold them
+        // reversed, with every combination of the bits that follow
+        memset(code.fast, 0, sizeof(code.fast));
+        int value = 0;
+        int index = 0;
+        for (int length = 1; length <= FastBits; ++length)
+        {
+            for (int i = 0; i < code.counts[length]; ++i, ++value, ++index)
+            {
+                int reversed = 0;
+                for (int b = 0; b < length; ++b)
+                {
+                    reversed |= ((value >> b) & 1) << (length - 1 - b);
+                }
+                for (int k = reversed; k < (1 << FastBits); k += 1 << length)
+                {
+                    code.fast[k] = uint16_t(length << 9 | code.symbols[index]);
+                }
+            }
+            value <<= 1;
+        }
+        return true;
+    }
+
+    void BuildFixedCodes()
+    {
+        uint8_t lengths[MaxSymbols];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 256 - 144);
+        memset(lengths + 256, 7, 280 - 256);
+        memset(lengths + 280, 8, MaxSymbols - 280);
+        BuildCode(litLen, lengths, MaxSymbols);
+        memset(lengths, 5, 32);
+        BuildCode(dist, lengths, 32);
+    }
+
+    bool ReadDynamicCodes()
+    {
+        using namespace deflate;
+
+        int litLenCount = int(GetBits(5)) + 257;
+        int distCount = int(GetBits(5)) + 1;
+        int codeLengthCount = int(GetBits(4)) + 4;
+        if (litLenCount > LitLenCodes || distCount > DistCodes) return false;
+
+        uint8_t codeLengthLengths[CodeLengthCodes] = {};
+        for (int i = 0; i < codeLengthCount; ++i)
+        {
+            codeLengthLengths[codeLengthOrder[i]] = uint8_t(GetBits(3));
+        }
+        Huffman codeLengths;
+        if (!BuildCode(codeLengths, codeLengthLengths, CodeLengthCodes)) return false;
+
+        // Literal/length and distance code lengths are one sequence, so repeats can
+        // run from one into the other
+        uint8_t lengths[LitLenCodes + DistCodes] = {};
+        int total = litLenCount + distCount;
+        for (int i = 0; i < total; )
+        {
+            int symbol = Decode(codeLengths);
+            if (symbol < 0) return false;
+            if (symbol < 16)
+            {
+                lengths[i++] = uint8_t(symbol);
+                continue;
+            }
+
+            uint8_t repeated = 0;
+            int count;
+            if (symbol == 16)
+            {
+                if (i == 0) return false;
+                repeated = lengths[i - 1];
+                count = 3 + int(GetBits(2));
+            }
+            else if (symbol == 17)
+            {
+                count = 3 + int(GetBits(3));
+            }
+            else
+            {
+                count = 11 + int(GetBits(7));
+            }
+            if (i + count > total) return false;
+            memset(lengths + i, repeated, size_t(count));
+            i += count;
+        }
+
+        if (lengths[EndOfBlock] == 0) return false;
+        return BuildCode(litLen, lengths, litLenCount)
+            && BuildCode(dist, lengths + litLenCount, distCount);
+    }
+};
@@ -0,0 +1,294 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A string as a quoted JSON string, escaping quotes, backslashes and control characters
+
+inline std::string JsonQuote(std::string_view str)
+{
+    std::string out;
+    out.reserve(str.size() + 2);
+    out += '"';
+    for (char c : str)
+    {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+                out += escape;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+// A value in a flat JSON object: a string, with escapes decoded, or the text of a
+// number, true, false or null
+
+struct JsonValue
+{
+    enum class Kind
+    {
+        string,
+        number,
+        boolean,
+        null
+    };
+
+    Kind kind = Kind::null;
+    std::string text;
+
+    bool IsString() const noexcept { return kind == Kind::string; }
+    bool IsNumber() const noexcept { return kind == Kind::number; }
+    bool IsTrue() const noexcept { return kind == Kind::boolean && text == "true"; }
+
+    // The value as JSON again
+    std::string ToJson() const { return kind == Kind::string ? JsonQuote(text) : text; }
+};
+
+// A JSON object whose values are all strings, numbers, booleans or null, as in a line
+// of a line-delimited JSON protocol.  Nested objects and arrays aren't supported.
+
+class JsonObject
+{
+    std::vector<std::pair<std::string, JsonValue>> fields;
+
+public:
+    // Parse the object, replacing any fields from before.  On failure, "error" says why.
+
+    bool Parse(std::string_view json, std::string& error)
+    {
+        fields.clear();
+        size_t pos = 0;
+
+        auto skipSpace = [&]
+        {
+            while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\r' || json[pos] == '\n')) ++pos;
+        };
+        auto fail = [&](char const* what)
+        {
+            error = std::string(what) + " at offset " + std::to_string(pos);
+            return false;
+        };
+
+        skipSpace();
+        if (pos == json.size() || json[pos] != '{') return fail("Expected '{'");
+        ++pos;
+        skipSpace();
+        if (pos < json.size() && json[pos] == '}')
+        {
+            ++pos;
+        }
+        else
+        {
+            for (;;)
+            {
+                std::string key;
+                JsonValue value;
+                skipSpace();
+                if (!ParseString(json, pos, key)) return fail("Expected a string key");
+                skipSpace();
+                if (pos == json.size() || json[pos] != ':') return fail("Expected ':'");
+                ++pos;
+                skipSpace();
+                if (!ParseValue(json, pos, value)) return fail("Expected a string, number, true, false or null");
+                fields.emplace_back(std::move(key), std::move(value));
+
+                skipSpace();
+                if (pos < json.size() && json[pos] == ',')
+                {
+                    ++pos;
+                    continue;
+                }
+                if (pos < json.size() && json[pos] == '}')
+                {
+                    ++pos;
+                    break;
+                }
+                return fail("Expected ',' or '}'");
+            }
+        }
+
+        skipSpace();
+        if (pos != json.size()) return fail("Unexpected text after the object");
+        return true;
+    }
+
+    // The value of a field, or null if there is none.  With repeated keys, the last wins.
+
+    JsonValue const* Find(std::string_view key) const noexcept
+    {
+        for (auto it = fields.rbegin(); it != fields.rend(); ++it)
+        {
+            if (it->first == key) return &it->second;
+        }
+        return nullptr;
+    }
+
+    std::vector<std::pair<std::string, JsonValue>> const& Fields() const noexcept { return fields; }
+
+private:
+    static void AppendUtf8(std::string& out, uint32_t c)
+    {
+        if (c < 0x80)
+        {
+            out += char(c);
+        }
+        else if (c < 0x800)
+        {
+            out += char(0xC0 | (c >> 6));
+            out += char(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            out += char(0xE0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += char(0xF0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3F));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+
+    static bool ParseHex4(std::string_view json, size_t& pos, uint32_t& c)
+    {
+        if (json.size() - pos < 4) return false;
+        c = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char h = json[pos++];
+            c <<= 4;
+            if (h >= '0' && h <= '9') c |= uint32_t(h - '0');
+            else if (h >= 'a' && h <= 'f') c |= uint32_t(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F') c |= uint32_t(h - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    static bool ParseString(std::string_view json, size_t& pos, std::string& out)
+    {
+        if (pos == json.size() || json[pos] != '"') return false;
+        ++pos;
+        while (pos < json.size())
+        {
+            char c = json[pos++];
+            if (c == '"') return true;
+            if ((unsigned char)c < 0x20) return false;
+            if (c != '\\')
+            {
+                out += c;
+                continue;
+            }
+
+            if (pos == json.size()) return false;
+            switch (json[pos++])
+            {
+            case '"':  out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/':  out += '/'; break;
+            case 'b':  out += '\b'; break;
+            case 'f':  out += '\f'; break;
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            case 't':  out += '\t'; break;
+            case 'u':
+            {
+                uint32_t code;
+                if (!ParseHex4(json, pos, code)) return false;
+
+                // Characters beyond the BMP come as a surrogate pair
+                uint32_t low;
+                if (code >= 0xD800 && code < 0xDC00 && json.substr(pos, 2) == "\\u")
+                {
+                    pos += 2;
+                    if (!ParseHex4(json, pos, low) || low < 0xDC00 || low >= 0xE000) return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    static bool ParseValue(std::string_view json, size_t& pos, JsonValue& value)
+    {
+        if (pos == json.size()) return false;
+        if (json[pos] == '"')
+        {
+            value.kind = JsonValue::Kind::string;
+            return ParseString(json, pos, value.text);
+        }
+
+        for (char const* literal : {"true", "false", "null"})
+        {
+            std::string_view word(literal);
+            if (json.substr(pos, word.size()) == word)
+            {
+                value.kind = word == "null" ? JsonValue::Kind::null : JsonValue::Kind::boolean;
+                value.text = literal;
+                pos += word.size();
+                return true;
+            }
+        }
+
+        // A number, checked for the JSON grammar, and kept as text
+        size_t begin = pos;
+        auto digits = [&]
+        {
+            size_t start = pos;
+            while (pos < json.size() && json[pos] >= '0' && json[pos] <= '9') ++pos;
+            return pos > start;
+        };
+        if (json[pos] == '-') ++pos;
+        if (!digits()) return false;
+        if (pos < json.size() && json[pos] == '.')
+        {
+            ++pos;
+            if (!digits()) return false;
+        }
+        if (pos < json.size() && (json[pos] == 'e' || json[pos] == 'E'))
+        {
+            ++pos;
+            if (pos < json.size() && (json[pos] == '+' || json[pos] == '-')) ++pos;
+            if (!digits()) return false;
+        }
+        value.kind = JsonValue::Kind::number;
+        value.text = std::string(json.substr(begin, pos - begin));
+        return true;
+    }
+};
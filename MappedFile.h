@@ -0,0 +1,91 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file, mapped into memory.  The mapping is copy-on-write,
+// so the contents may be modified in memory without affecting the file.
+
+class MappedFile
+{
+    unsigned char* data{};
+    size_t size{};
+
+public:
+    MappedFile() = default;
+
+    MappedFile(MappedFile const& other) = delete;
+    MappedFile& operator=(MappedFile const& other) = delete;
+
+    explicit MappedFile(char const* fileName) noexcept
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+                if (data) size = size_t(fileSize.QuadPart);
+                CloseHandle(mapping); // View keeps the mapping alive
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = open(fileName, O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void* p = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                data = static_cast<unsigned char*>(p);
+                size = size_t(st.st_size);
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd); // Mapping stays valid after the descriptor is closed
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (!data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(data, size);
+#endif
+    }
+
+    bool Valid() const noexcept { return data != nullptr; }
+
+    unsigned char* Data() const noexcept { return data; }
+    size_t Size() const noexcept { return size; }
+};
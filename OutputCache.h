@@ -0,0 +1,74 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+// Directory of output files from earlier conversions, each named for a 64-bit key of
+// everything that went into it (see CacheKey).  Outputs are copied in and out, never
+// linked, so overwriting an output later can't change the cache.  Entries are added
+// under a temporary name and renamed into place, so processes sharing a cache never
+// see a partial file.
+
+class OutputCache
+{
+    std::filesystem::path dir;
+
+public:
+    explicit OutputCache(std::filesystem::path dir_)
+        : dir(std::move(dir_))
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+    }
+
+    std::filesystem::path EntryFor(uint64_t key, std::string const& ext) const
+    {
+        char name[24];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+        return dir / (name + ext);
+    }
+
+    // Copy the entry for key to outputFile, if there is one
+    bool Fetch(uint64_t key, std::string const& ext, std::filesystem::path const& outputFile) const
+    {
+        std::error_code ec;
+        std::filesystem::path entry = EntryFor(key, ext);
+        if (!std::filesystem::is_regular_file(entry, ec)) return false;
+        return std::filesystem::copy_file(entry, outputFile, std::filesystem::copy_options::overwrite_existing, ec);
+    }
+
+    // Copy outputFile into the cache as the entry for key
+    bool Store(uint64_t key, std::string const& ext, std::filesystem::path const& outputFile) const
+    {
+        static std::atomic<uint64_t> s_tempCount{0};
+
+        std::filesystem::path entry = EntryFor(key, ext);
+        std::filesystem::path temp = entry;
+        temp += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+              + "." + std::to_string(s_tempCount++) + ".tmp";
+
+        std::error_code ec;
+        if (!std::filesystem::copy_file(outputFile, temp, std::filesystem::copy_options::overwrite_existing, ec))
+        {
+            return false;
+        }
+        std::filesystem::rename(temp, entry, ec);
+        if (!ec) return true;
+
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+};
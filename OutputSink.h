@@ -0,0 +1,314 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Destination for serialized output bytes.  Writers push data in order, and call
+// Close() once when finished.  A failed Write() or Close() means the output is
+// incomplete, and further writes may be ignored.
+
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+
+    virtual bool Write(char const* data, size_t size) = 0;
+    virtual bool Close() = 0;
+
+    // Hint that about this many bytes will be written in all, so storage for them can
+    // be set aside at once.  Does nothing by default.
+    virtual void Preallocate(uint64_t expectedSize) noexcept { (void)expectedSize; }
+
+    bool Write(std::string const& str) { return Write(str.data(), str.size()); }
+};
+
+// Output sink writing to a file, or to stdout if the name is "-", through one large
+// buffer, so that many small writes are coalesced into few large write(2) or WriteFile
+// calls.  File systems where each call is costly, like NFS, want a big buffer.
+//
+// With directIO, on Linux, the file is opened with O_DIRECT, bypassing the page cache,
+// which keeps huge outputs from evicting everything else.  Only the final partial
+// buffer is written without it.  If the file system doesn't support O_DIRECT, the file
+// is written normally.
+
+class FileOutputSink : public OutputSink
+{
+public:
+    static constexpr size_t DefaultBufferSize = 4 << 20;
+    static constexpr size_t DirectAlignment = 4096;
+
+private:
+    std::unique_ptr<char[]> storage;
+    char* buffer;           // Aligned for direct I/O
+    size_t bufferSize;
+    size_t used = 0;
+    uint64_t written = 0;
+    uint64_t preallocated = 0;
+    bool direct = false;
+    bool ownsFile = true;
+    bool failed = false;
+    bool closed = false;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+
+public:
+    FileOutputSink(std::string const& fileName, size_t bufferSize_ = DefaultBufferSize, bool directIO = false)
+        : bufferSize((std::max<size_t>(bufferSize_, 1) + DirectAlignment - 1) / DirectAlignment * DirectAlignment)
+    {
+        storage.reset(new char[bufferSize + DirectAlignment]);
+        buffer = storage.get() + (DirectAlignment - uintptr_t(storage.get()) % DirectAlignment) % DirectAlignment;
+
+        ownsFile = fileName != "-";
+#ifdef _WIN32
+        (void)directIO;
+        file = ownsFile
+            ? CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr)
+            : GetStdHandle(STD_OUTPUT_HANDLE);
+        failed = file == INVALID_HANDLE_VALUE || file == nullptr;
+#else
+        if (!ownsFile)
+        {
+            fd = STDOUT_FILENO;
+            return;
+        }
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (directIO)
+        {
+            fd = open(fileName.c_str(), flags | O_DIRECT, 0666);
+            direct = fd >= 0;
+        }
+#else
+        (void)directIO;
+#endif
+        if (fd < 0) fd = open(fileName.c_str(), flags, 0666);
+        failed = fd < 0;
+#endif
+    }
+
+    FileOutputSink(FileOutputSink const& other) = delete;
+    FileOutputSink& operator=(FileOutputSink const& other) = delete;
+
+    ~FileOutputSink()
+    {
+        if (!closed) Close();
+    }
+
+    bool Valid() const noexcept { return !failed; }
+
+    // Bytes written to the file so far, not counting any still in the buffer
+    uint64_t BytesWritten() const noexcept { return written; }
+
+    // Reserve disk space for a file expected to be about this big, so it is laid out
+    // contiguously.  The file size doesn't change, and space reserved beyond the end is
+    // released by Close().  Only done on Linux, and only by file systems that support
+    // it natively; elsewhere this does nothing.
+
+    void Preallocate(uint64_t expectedSize) noexcept override
+    {
+#ifdef __linux__
+        if (!failed && ownsFile && expectedSize > 0
+            && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, off_t(expectedSize)) == 0)
+        {
+            preallocated = expectedSize;
+        }
+#else
+        (void)expectedSize;
+#endif
+    }
+
+    using OutputSink::Write;
+
+    bool Write(char const* data, size_t size) override
+    {
+        if (failed) return false;
+
+        // Big writes skip the buffer, unless its alignment is needed
+        if (used == 0 && size >= bufferSize && !direct)
+        {
+            return WriteAll(data, size);
+        }
+
+        while (size > 0)
+        {
+            size_t n = std::min(size, bufferSize - used);
+            memcpy(buffer + used, data, n);
+            used += n;
+            data += n;
+            size -= n;
+
+            if (used == bufferSize)
+            {
+                if (!WriteAll(buffer, used)) return false;
+                used = 0;
+            }
+        }
+        return true;
+    }
+
+    // Write out everything buffered so far, so a reader of the file, or of stdout, sees it
+
+    bool Flush() noexcept
+    {
+        if (failed) return false;
+        if (used > 0)
+        {
+            if (used % DirectAlignment != 0) EndDirect();
+            if (!WriteAll(buffer, used)) return false;
+            used = 0;
+        }
+        return true;
+    }
+
+    bool Close() override
+    {
+        if (closed) return false;
+        closed = true;
+
+        if (!failed && used > 0)
+        {
+            // A partial buffer can't be written with O_DIRECT
+            if (used % DirectAlignment != 0) EndDirect();
+            WriteAll(buffer, used);
+            used = 0;
+        }
+
+#ifdef _WIN32
+        if (ownsFile && file != INVALID_HANDLE_VALUE && !CloseHandle(file)) failed = true;
+#else
+        if (preallocated > written && !failed && ftruncate(fd, off_t(written)) != 0) failed = true;
+        if (ownsFile && fd >= 0 && close(fd) != 0) failed = true;
+#endif
+        return !failed;
+    }
+
+private:
+    void EndDirect() noexcept
+    {
+#if defined(O_DIRECT) && !defined(_WIN32)
+        if (direct) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+        direct = false;
+    }
+
+    bool WriteAll(char const* data, size_t size) noexcept
+    {
+        while (size > 0 && !failed)
+        {
+#ifdef _WIN32
+            DWORD n = 0;
+            if (!WriteFile(file, data, DWORD(std::min<size_t>(size, 1u << 30)), &n, nullptr))
+            {
+                failed = true;
+                break;
+            }
+#else
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL && direct)
+            {
+                // File system refused O_DIRECT after all
+                EndDirect();
+                continue;
+            }
+            if (n <= 0)
+            {
+                failed = true;
+                break;
+            }
+#endif
+            data += n;
+            size -= size_t(n);
+            written += uint64_t(n);
+        }
+        return !failed;
+    }
+};
+
+// Output sink that discards everything written to it, only counting the bytes
+
+class CountingOutputSink : public OutputSink
+{
+    uint64_t size = 0;
+
+public:
+    using OutputSink::Write;
+
+    bool Write(char const* data, size_t n) override
+    {
+        (void)data;
+        size += n;
+        return true;
+    }
+
+    bool Close() override { return true; }
+
+    uint64_t Size() const noexcept { return size; }
+};
+
+// Output sink collecting everything written to it in memory.  Clear() empties it for
+// reuse, keeping its memory, so a sink reused for many outputs stops allocating once
+// it has held the biggest.
+
+class MemoryOutputSink : public OutputSink
+{
+    std::string data;
+
+public:
+    using OutputSink::Write;
+
+    bool Write(char const* p, size_t n) override
+    {
+        data.append(p, n);
+        return true;
+    }
+
+    bool Close() override { return true; }
+
+    void Preallocate(uint64_t expectedSize) noexcept override
+    {
+        try
+        {
+            if (expectedSize < data.max_size()) data.reserve(size_t(expectedSize));
+        }
+        catch (std::exception const&)
+        {
+            // Only a hint, so the data grows as it's written instead
+        }
+    }
+
+    void Clear() noexcept { data.clear(); }
+
+    char const* Data() const noexcept { return data.data(); }
+    size_t Size() const noexcept { return data.size(); }
+};
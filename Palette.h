@@ -0,0 +1,232 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// Set of distinct colors, each assigned a small index in order of first appearance.
+// Colors are found by key in an open-addressed hash table with linear probing, kept at
+// most half full, so a palette makes a few allocations in all instead of one per color.
+
+class Palette
+{
+    static constexpr uint32_t Empty = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t key;
+        uint32_t index;  // Empty if the slot is free
+    };
+
+    std::vector<Slot> slots;
+    int hashShift = 32;
+    std::vector<RasterImage::RGBA> colors;
+
+    // Slot holding key, or the free slot where it goes
+    size_t SlotOf(uint32_t key) const noexcept
+    {
+        size_t const mask = slots.size() - 1;
+        for (size_t i = uint32_t(key * 2654435761u) >> hashShift; ; i = (i + 1) & mask)
+        {
+            if (slots[i].index == Empty || slots[i].key == key) return i;
+        }
+    }
+
+    void Grow()
+    {
+        size_t size = std::max<size_t>(16, slots.size() * 2);
+        slots.assign(size, Slot{0, Empty});
+        for (hashShift = 32; (size_t(1) << (32 - hashShift)) < size; --hashShift) {}
+
+        for (uint32_t i = 0; i < colors.size(); ++i)
+        {
+            uint32_t key = Key(colors[i]);
+            slots[SlotOf(key)] = Slot{key, i};
+        }
+    }
+
+public:
+    static uint32_t Key(RasterImage::RGBA c) noexcept
+    {
+        return uint32_t(c.r) | (uint32_t(c.g) << 8) | (uint32_t(c.b) << 16) | (uint32_t(c.a) << 24);
+    }
+
+    // Look up a color's index, adding the color if it's new
+
+    uint32_t Add(RasterImage::RGBA c)
+    {
+        if (2 * (colors.size() + 1) > slots.size()) Grow();
+
+        uint32_t key = Key(c);
+        Slot& slot = slots[SlotOf(key)];
+        if (slot.index == Empty)
+        {
+            slot = Slot{key, uint32_t(colors.size())};
+            colors.push_back(c);
+        }
+        return slot.index;
+    }
+
+    // Add every color of a row of pixels, looking up each run of identical pixels once
+
+    void AddRow(RasterImage::RGBA const* row, size_t count)
+    {
+        for (size_t c = 0; c < count; ++c)
+        {
+            if (c == 0 || Key(row[c]) != Key(row[c - 1])) Add(row[c]);
+        }
+    }
+
+    // Remove every color, keeping the table's memory for reuse
+    void Clear() noexcept
+    {
+        std::fill(slots.begin(), slots.end(), Slot{0, Empty});
+        colors.clear();
+    }
+
+    // Look up a color's index, which must already be in the palette
+    uint32_t IndexOf(RasterImage::RGBA c) const noexcept
+    {
+        return slots[SlotOf(Key(c))].index;
+    }
+
+    size_t Size() const noexcept { return colors.size(); }
+
+    RasterImage::RGBA Color(uint32_t index) const noexcept { return colors[index]; }
+};
+
+// Most frequent color of an image, counted with one pass over its runs of identical
+// pixels.  Ties go to the color with the smaller key.
+
+inline RasterImage::RGBA MostFrequentColor(RasterImage const& img)
+{
+    Palette palette;
+    std::vector<uint64_t> counts;
+    std::vector<RasterImage::RGBA> row(img.Width());
+
+    for (int r = 0; r < img.Height(); ++r)
+    {
+        img.GetRowRGBA(r, row.data());
+        int runBegin = 0;
+        for (int c = 1; c <= img.Width(); ++c)
+        {
+            if (c < img.Width() && Palette::Key(row[c]) == Palette::Key(row[runBegin])) continue;
+            uint32_t index = palette.Add(row[runBegin]);
+            if (index == counts.size()) counts.push_back(0);
+            counts[index] += uint64_t(c - runBegin);
+            runBegin = c;
+        }
+    }
+
+    RasterImage::RGBA best{0, 0, 0, 0};
+    uint64_t bestCount = 0;
+    for (uint32_t i = 0; i < palette.Size(); ++i)
+    {
+        RasterImage::RGBA color = palette.Color(i);
+        if (counts[i] > bestCount || (counts[i] == bestCount && Palette::Key(color) < Palette::Key(best)))
+        {
+            best = color;
+            bestCount = counts[i];
+        }
+    }
+    return best;
+}
+
+// Number of distinct colors in an image
+
+inline size_t CountColors(RasterImage const& img)
+{
+    Palette palette;
+    std::vector<RasterImage::RGBA> row(img.Width());
+    for (int r = 0; r < img.Height(); ++r)
+    {
+        img.GetRowRGBA(r, row.data());
+        palette.AddRow(row.data(), row.size());
+    }
+    return palette.Size();
+}
+
+// Elements bucketed by color.  "order" lists element indices grouped by palette color,
+// keeping the original element order within each color.  Color i's elements are
+// order[bucketStart[i]] to order[bucketStart[i + 1] - 1].  elementColor holds the
+// palette index of each element.
+
+struct ColorBuckets
+{
+    Palette palette;
+    std::vector<uint32_t> elementColor;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> bucketStart;
+};
+
+// Sort elements into buckets by their palette index, given in b.elementColor, with a
+// counting sort
+
+inline void SortIntoBuckets(ColorBuckets& b)
+{
+    size_t count = b.elementColor.size();
+
+    b.bucketStart.assign(b.palette.Size() + 1, 0);
+    for (uint32_t color : b.elementColor)
+    {
+        ++b.bucketStart[color + 1];
+    }
+    for (size_t i = 1; i < b.bucketStart.size(); ++i)
+    {
+        b.bucketStart[i] += b.bucketStart[i - 1];
+    }
+
+    std::vector<uint32_t> next(b.bucketStart.begin(), b.bucketStart.end() - 1);
+    b.order.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        b.order[next[b.elementColor[i]]++] = uint32_t(i);
+    }
+}
+
+// Build the palette and buckets for "count" elements, where colorAt(i) returns element
+// i's color.  Uses one hashing pass to assign colors, then a counting sort.
+
+template <typename ColorAt>
+ColorBuckets BucketByColor(size_t count, ColorAt&& colorAt)
+{
+    ColorBuckets b;
+    b.elementColor.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        b.elementColor[i] = b.palette.Add(colorAt(i));
+    }
+
+    SortIntoBuckets(b);
+    return b;
+}
+
+// Build the buckets for "count" elements whose colors are already known by index in a
+// palette, where indexAt(i) returns element i's index.  No hashing is needed.
+
+template <typename IndexAt>
+ColorBuckets BucketByIndex(size_t count, Palette const& palette, IndexAt&& indexAt)
+{
+    ColorBuckets b;
+    b.palette = palette;
+    b.elementColor.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        b.elementColor[i] = indexAt(i);
+    }
+
+    SortIntoBuckets(b);
+    return b;
+}
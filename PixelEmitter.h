@@ -0,0 +1,473 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "simple_svg_1.0.0.hpp"
+
+#include "RasterImage.h"
+#include "RegionTrace.h"
+#include "TextBuffer.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <vector>
+
+// Fast-path serializer for pixel rectangles and region outlines.  Produces exactly the
+// same text as an svg::Polygon or svg::Path with svg::Fill and svg::Stroke attributes,
+// but formats straight into a caller-provided buffer without building any temporary
+// objects, so there are no heap allocations per element.  Partially transparent colors
+// also get a fill-opacity, which simple-svg has no way to express.
+//
+// Fill and stroke can either be written on every element, or left off so that they are
+// inherited from enclosing groups, or (for fill) set by a CSS class per palette color.
+
+enum class ShapeStyle
+{
+    inlined,  // fill and stroke attributes on each element
+    grouped,  // no fill or stroke attributes, inherited from enclosing <g> elements
+    classed,  // class attribute naming a palette color, stroke inherited
+};
+
+class PixelEmitter
+{
+    svg::Layout layout;
+    svg::Stroke stroke;
+    bool hasStroke;
+    ShapeStyle style;
+    std::string elemSuffix; // Identical for every element, so formatted once
+
+    // Longest possible output, not counting the element suffix: tab, tag, 8 coordinates
+    // of up to 13 chars, separators, an rgb() fill or class, and a fill-opacity
+    static constexpr size_t MaxLengthNoStroke = 32 + 8 * 14 + 40 + 32;
+
+    // Longest possible "x,y " pair in a point list
+    static constexpr size_t MaxPointLength = 2 * 14;
+
+    // Points are always on pixel edges, so the text of every x from 0 to the width, and
+    // every y from 0 to the height, is formatted once up front and copied from then on.
+    // Each entry is copied whole, with the length kept in its last byte.  Coordinates
+    // past MaxTableSize, on huge images, are formatted as they come.
+    static constexpr int MaxTableSize = 65536;
+    struct FormattedCoord
+    {
+        char text[15];
+        uint8_t size;
+    };
+    std::vector<FormattedCoord> xCoords;
+    std::vector<FormattedCoord> yCoords;
+
+public:
+    // A stroke width of 0 leaves out stroke attributes altogether
+
+    PixelEmitter(svg::Layout const& layout_, double strokeWidth, ShapeStyle style_ = ShapeStyle::inlined)
+        : layout(layout_)
+        , stroke(strokeWidth > 0 ? strokeWidth : -1, svg::Color::Black)
+        , hasStroke(strokeWidth > 0)
+        , style(style_)
+        , elemSuffix((style_ == ShapeStyle::inlined ? stroke.toString(layout_) : "") + svg::emptyElemEnd())
+    {
+        if (layout.scale > 0)
+        {
+            BuildCoords(xCoords, layout.dimensions.width / layout.scale, [&](int x) { return svg::translateX(x, layout); });
+            BuildCoords(yCoords, layout.dimensions.height / layout.scale, [&](int y) { return svg::translateY(y, layout); });
+        }
+    }
+
+    // Space that must be available at the destination for one element
+    size_t MaxLength() const noexcept { return MaxLengthNoStroke + elemSuffix.size(); }
+
+    bool HasStroke() const noexcept { return hasStroke; }
+
+    // Format a number the same way std::ostream does by default (i.e. "%g").
+    // Whole numbers, which are by far the most common, skip the printf machinery.
+
+    static char* FormatNumber(char* out, double v) noexcept
+    {
+        if (v == floor(v) && fabs(v) < 1e6 && !(v == 0.0 && signbit(v)))
+        {
+            return std::to_chars(out, out + 16, long(v)).ptr;
+        }
+
+        return out + snprintf(out, 16, "%g", v);
+    }
+
+    static char* FormatInt(char* out, int v) noexcept
+    {
+        return std::to_chars(out, out + 16, v).ptr;
+    }
+
+    template <size_t N>
+    static char* FormatLiteral(char* out, char const (&str)[N]) noexcept
+    {
+        memcpy(out, str, N - 1);
+        return out + (N - 1);
+    }
+
+    // Fully transparent shapes aren't drawn at all
+    static bool IsVisible(RasterImage::RGBA color) noexcept
+    {
+        return color.a != 0;
+    }
+
+    static char* FormatColor(char* out, RasterImage::RGBA color) noexcept
+    {
+        out = FormatLiteral(out, "rgb(");
+        out = FormatInt(out, color.r);
+        *out++ = ',';
+        out = FormatInt(out, color.g);
+        *out++ = ',';
+        out = FormatInt(out, color.b);
+        *out++ = ')';
+        return out;
+    }
+
+    // Format a color's alpha as an opacity from 0 to 1, for partially transparent colors
+    // only, in attribute or CSS property form
+
+    static char* FormatOpacityAttr(char* out, RasterImage::RGBA color) noexcept
+    {
+        if (color.a == 0xFF) return out;
+        out = FormatLiteral(out, " fill-opacity=\"");
+        out = FormatNumber(out, color.a / 255.0);
+        *out++ = '"';
+        return out;
+    }
+
+    static char* FormatOpacityProperty(char* out, RasterImage::RGBA color) noexcept
+    {
+        if (color.a == 0xFF) return out;
+        out = FormatLiteral(out, ";fill-opacity:");
+        return FormatNumber(out, color.a / 255.0);
+    }
+
+    // An x or y coordinate, as in a point.  "out" must have room for 15 chars.
+
+    char* FormatX(char* out, int x) const noexcept
+    {
+        if (unsigned(x) < xCoords.size()) return CopyCoord(out, xCoords[x]);
+        return FormatNumber(out, svg::translateX(x, layout));
+    }
+
+    char* FormatY(char* out, int y) const noexcept
+    {
+        if (unsigned(y) < yCoords.size()) return CopyCoord(out, yCoords[y]);
+        return FormatNumber(out, svg::translateY(y, layout));
+    }
+
+    char* FormatPoint(char* out, int x, int y) const noexcept
+    {
+        out = FormatX(out, x);
+        *out++ = ',';
+        out = FormatY(out, y);
+        *out++ = ' ';
+        return out;
+    }
+
+    // Length of the text FormatStyle() gives
+
+    size_t StyleLength(RasterImage::RGBA color, uint32_t colorIndex) const noexcept
+    {
+        size_t length = elemSuffix.size();
+        switch (style)
+        {
+        case ShapeStyle::inlined:
+            length += 6 + 4 + IntLength(color.r) + 1 + IntLength(color.g) + 1 + IntLength(color.b) + 1 + 2;
+            if (color.a != 0xFF)
+            {
+                char opacity[32];
+                length += 16 + size_t(FormatNumber(opacity, color.a / 255.0) - opacity);
+            }
+            break;
+        case ShapeStyle::classed:
+            length += 8 + IntLength(colorIndex) + 2;
+            break;
+        case ShapeStyle::grouped:
+            break;
+        }
+        return length;
+    }
+
+    // Format the fill or class, any stroke attributes, and the end of an element, for
+    // the emitter's style.  colorIndex is the color's palette index, for classed style.
+
+    char* FormatStyle(char* out, RasterImage::RGBA color, uint32_t colorIndex) const noexcept
+    {
+        switch (style)
+        {
+        case ShapeStyle::inlined:
+            out = FormatLiteral(out, "fill=\"");
+            out = FormatColor(out, color);
+            *out++ = '"';
+            out = FormatOpacityAttr(out, color);
+            *out++ = ' ';
+            break;
+        case ShapeStyle::classed:
+            out = FormatLiteral(out, "class=\"c");
+            out = std::to_chars(out, out + 16, colorIndex).ptr;
+            out = FormatLiteral(out, "\" ");
+            break;
+        case ShapeStyle::grouped:
+            break;
+        }
+
+        memcpy(out, elemSuffix.data(), elemSuffix.size());
+        return out + elemSuffix.size();
+    }
+
+    // Format a w x h rectangle with top-left corner at pixel column x, row y, as a
+    // <polygon> element.  "out" must have room for MaxLength() chars.  Returns the
+    // end of the formatted text.
+
+    char* FormatRect(char* out, int x, int y, int w, int h, RasterImage::RGBA color, uint32_t colorIndex = 0) const noexcept
+    {
+        out = FormatLiteral(out, "\t<polygon points=\"");
+        out = FormatPoint(out, x,     y    );
+        out = FormatPoint(out, x + w, y    );
+        out = FormatPoint(out, x + w, y + h);
+        out = FormatPoint(out, x,     y + h);
+        out = FormatLiteral(out, "\" ");
+        return FormatStyle(out, color, colorIndex);
+    }
+
+    void EmitRect(TextBuffer& text, int x, int y, int w, int h, RasterImage::RGBA color, uint32_t colorIndex = 0) const
+    {
+        text.Commit(FormatRect(text.Reserve(MaxLength()), x, y, w, h, color, colorIndex));
+    }
+
+    // Length of the text FormatRect() gives, worked out without formatting it
+
+    size_t RectLength(int x, int y, int w, int h, RasterImage::RGBA color, uint32_t colorIndex = 0) const noexcept
+    {
+        size_t xs = CoordLength(xCoords, x, svg::translateX(x, layout))
+                  + CoordLength(xCoords, x + w, svg::translateX(x + w, layout));
+        size_t ys = CoordLength(yCoords, y, svg::translateY(y, layout))
+                  + CoordLength(yCoords, y + h, svg::translateY(y + h, layout));
+
+        // Tag, 4 points of "x,y ", end of the points, style
+        return 18 + 2 * (xs + ys) + 8 + 2 + StyleLength(color, colorIndex);
+    }
+
+    // Format a region outline as a <path> with one subpath per loop, using the even-odd
+    // fill rule so holes are left unfilled
+
+    void EmitPath(TextBuffer& text, RegionOutline const& region, RasterImage::RGBA color, uint32_t colorIndex = 0) const
+    {
+        char* out = text.Reserve(32);
+        out = FormatLiteral(out, "\t<path d=\"");
+        text.Commit(out);
+
+        uint32_t begin = 0;
+        for (uint32_t end : region.loopEnds)
+        {
+            out = text.Reserve(8 + (end - begin) * MaxPointLength);
+            *out++ = 'M';
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                out = FormatPoint(out, region.points[i].x, region.points[i].y);
+            }
+            out = FormatLiteral(out, "z ");
+            text.Commit(out);
+            begin = end;
+        }
+
+        out = text.Reserve(MaxLength());
+        out = FormatLiteral(out, "\" fill-rule=\"evenodd\" ");
+        text.Commit(FormatStyle(out, color, colorIndex));
+    }
+
+    // Markup shared by many elements, for grouped and classed styles
+
+    // Unstroked rectangle covering the whole w x h image, drawn before everything else
+    void EmitBackground(TextBuffer& text, int w, int h, RasterImage::RGBA color) const
+    {
+        char* out = text.Reserve(MaxLength());
+        out = FormatLiteral(out, "<rect x=\"");
+        out = FormatNumber(out, svg::translateX(0, layout));
+        out = FormatLiteral(out, "\" y=\"");
+        out = FormatNumber(out, svg::translateY(0, layout));
+        out = FormatLiteral(out, "\" width=\"");
+        out = FormatNumber(out, svg::translateScale(w, layout));
+        out = FormatLiteral(out, "\" height=\"");
+        out = FormatNumber(out, svg::translateScale(h, layout));
+        out = FormatLiteral(out, "\" fill=\"");
+        out = FormatColor(out, color);
+        *out++ = '"';
+        out = FormatOpacityAttr(out, color);
+        text.Commit(FormatLiteral(out, " />\n"));
+    }
+
+    // Opening tag of a group setting the stroke for everything within it
+    std::string StrokeGroupStart() const
+    {
+        return "<g " + stroke.toString(layout) + ">\n";
+    }
+
+    // Opening tag of a group setting the fill for everything within it
+    void EmitFillGroupStart(TextBuffer& text, RasterImage::RGBA color) const
+    {
+        char* out = text.Reserve(MaxLength());
+        out = FormatLiteral(out, "<g fill=\"");
+        out = FormatColor(out, color);
+        *out++ = '"';
+        out = FormatOpacityAttr(out, color);
+        text.Commit(FormatLiteral(out, ">\n"));
+    }
+
+    void EmitGroupEnd(TextBuffer& text) const
+    {
+        text.Commit(FormatLiteral(text.Reserve(8), "</g>\n"));
+    }
+
+    // CSS rule for a palette color's class
+    void EmitClassRule(TextBuffer& text, RasterImage::RGBA color, uint32_t colorIndex) const
+    {
+        char* out = text.Reserve(MaxLength());
+        out = FormatLiteral(out, ".c");
+        out = std::to_chars(out, out + 16, colorIndex).ptr;
+        out = FormatLiteral(out, "{fill:");
+        out = FormatColor(out, color);
+        out = FormatOpacityProperty(out, color);
+        text.Commit(FormatLiteral(out, "}\n"));
+    }
+
+    // Compact path data, for drawing all shapes of one color as a single <path>.
+    // Shapes become subpaths using relative commands: "m" from the previous subpath's
+    // start (or "M" for the first), then "h" and "v" along the pixel edges, and "z".
+
+    // Opening of a path element for one color, up to the start of the path data
+    void EmitColorPathStart(TextBuffer& text, RasterImage::RGBA color) const
+    {
+        char* out = text.Reserve(MaxLength());
+        out = FormatLiteral(out, "\t<path fill=\"");
+        out = FormatColor(out, color);
+        *out++ = '"';
+        out = FormatOpacityAttr(out, color);
+        text.Commit(FormatLiteral(out, " fill-rule=\"evenodd\" d=\""));
+    }
+
+    void EmitColorPathEnd(TextBuffer& text) const
+    {
+        text.Commit(FormatLiteral(text.Reserve(8), "\" />\n"));
+    }
+
+    // Move to "to", relative to "from" unless this is the first subpath
+    char* FormatMove(char* out, GridPoint to, GridPoint const* from) const noexcept
+    {
+        double x = svg::translateX(to.x, layout);
+        double y = svg::translateY(to.y, layout);
+        if (from)
+        {
+            x -= svg::translateX(from->x, layout);
+            y -= svg::translateY(from->y, layout);
+        }
+
+        *out++ = from ? 'm' : 'M';
+        out = FormatNumber(out, x);
+        if (!(y < 0)) *out++ = ' '; // A minus sign separates numbers by itself
+        return FormatNumber(out, y);
+    }
+
+    char* FormatHorizontal(char* out, int fromX, int toX) const noexcept
+    {
+        *out++ = 'h';
+        return FormatNumber(out, svg::translateX(toX, layout) - svg::translateX(fromX, layout));
+    }
+
+    char* FormatVertical(char* out, int fromY, int toY) const noexcept
+    {
+        *out++ = 'v';
+        return FormatNumber(out, svg::translateY(toY, layout) - svg::translateY(fromY, layout));
+    }
+
+    // Subpath for a rectangle, whose start is its top-left corner.  "from" is the
+    // start of the previous subpath in the same path, or null if there is none.
+
+    void EmitRectSubpath(TextBuffer& text, ColorRect const& rect, GridPoint const* from) const
+    {
+        char* out = text.Reserve(6 * 16);
+        out = FormatMove(out, GridPoint{rect.x, rect.y}, from);
+        out = FormatHorizontal(out, rect.x, rect.x + rect.w);
+        out = FormatVertical(out, rect.y, rect.y + rect.h);
+        out = FormatHorizontal(out, rect.x + rect.w, rect.x);
+        text.Commit(FormatLiteral(out, "z"));
+    }
+
+    // Start of a region outline's last subpath, which is where "z" leaves the current point
+    static GridPoint LastSubpathStart(RegionOutline const& region) noexcept
+    {
+        size_t loops = region.loopEnds.size();
+        return region.points[loops > 1 ? region.loopEnds[loops - 2] : 0];
+    }
+
+    // Subpaths for all loops of a region outline.  Since loops have only horizontal and
+    // vertical edges, with collinear vertices removed, edges alternate between "h" and
+    // "v", and "z" draws the last one.
+
+    void EmitOutlineSubpaths(TextBuffer& text, RegionOutline const& region, GridPoint const* from) const
+    {
+        uint32_t begin = 0;
+        for (uint32_t end : region.loopEnds)
+        {
+            char* out = text.Reserve(8 + (end - begin) * 16);
+            GridPoint const* points = region.points.data();
+            out = FormatMove(out, points[begin], from);
+            for (uint32_t i = begin + 1; i < end; ++i)
+            {
+                out = points[i].y == points[i - 1].y
+                    ? FormatHorizontal(out, points[i - 1].x, points[i].x)
+                    : FormatVertical(out, points[i - 1].y, points[i].y);
+            }
+            text.Commit(FormatLiteral(out, "z"));
+
+            from = &points[begin];
+            begin = end;
+        }
+    }
+
+private:
+    // Entries for 0 to "edges", rounded, as formatted by FormatNumber(translate(i))
+    template <typename Translate>
+    static void BuildCoords(std::vector<FormattedCoord>& coords, double edges, Translate translate)
+    {
+        if (!(edges >= 0)) return;
+        int count = int(std::min(round(edges), double(MaxTableSize - 1))) + 1;
+        coords.resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            char text[32] = {};
+            size_t size = FormatNumber(text, translate(i)) - text;
+            memcpy(coords[i].text, text, sizeof(coords[i].text));
+            coords[i].size = uint8_t(size);
+        }
+    }
+
+    static size_t CoordLength(std::vector<FormattedCoord> const& coords, int i, double v) noexcept
+    {
+        if (unsigned(i) < coords.size()) return coords[i].size;
+        char text[32];
+        return size_t(FormatNumber(text, v) - text);
+    }
+
+    static size_t IntLength(uint32_t v) noexcept
+    {
+        size_t length = 1;
+        for (; v >= 10; v /= 10) ++length;
+        return length;
+    }
+
+    static char* CopyCoord(char* out, FormattedCoord const& coord) noexcept
+    {
+        memcpy(out, coord.text, sizeof(coord.text));
+        return out + coord.size;
+    }
+};
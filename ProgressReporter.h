@@ -0,0 +1,166 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <thread>
+
+// Reports the progress of a long conversion to a log, at a fixed interval, from a
+// thread of its own.  The conversion goes through stages (loading, merging, writing,
+// and so on), each of which may have a total count of units (rows, shapes) that it
+// advances through.  Each report shows the current stage, its units done, the rate of
+// progress, the bytes written so far, and an estimate of the time left, from the
+// rate over the last few intervals, so a slow start or a fast finish doesn't throw it
+// off for long.
+//
+// Nothing is printed until the first interval has passed, so quick conversions are
+// quiet.  Advance() and SetBytesWritten() may be called from any thread.  An interval
+// of 0 disables reporting.
+
+class ProgressReporter
+{
+    using clock = std::chrono::steady_clock;
+
+    // Progress at the last few reports of the stage, oldest first
+    static constexpr int WindowSize = 6;
+    struct Sample
+    {
+        clock::time_point time;
+        uint64_t done;
+    };
+
+    std::ostream& log;
+    clock::duration interval;
+    clock::time_point startTime = clock::now();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool stopping = false;
+
+    // Current stage, changed under the mutex
+    char const* stage = "starting";
+    char const* unit = nullptr;
+    uint64_t total = 0;
+    Sample window[WindowSize];
+    int sampleCount = 0;
+
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> bytesWritten{0};
+
+public:
+    ProgressReporter(std::ostream& log_, clock::duration interval_)
+        : log(log_)
+        , interval(interval_)
+    {
+        StartSamples();
+        if (interval.count() > 0) thread = std::thread([this] { Run(); });
+    }
+
+    ProgressReporter(ProgressReporter const& other) = delete;
+    ProgressReporter& operator=(ProgressReporter const& other) = delete;
+
+    ~ProgressReporter()
+    {
+        Stop();
+    }
+
+    // Start a stage with "total" units to go through, or with no count if it's 0
+    void Stage(char const* name, uint64_t total_ = 0, char const* unit_ = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stage = name;
+        unit = unit_;
+        total = total_;
+        done = 0;
+        StartSamples();
+    }
+
+    void Advance(uint64_t units) noexcept { done.fetch_add(units, std::memory_order_relaxed); }
+
+    void SetBytesWritten(uint64_t bytes) noexcept { bytesWritten.store(bytes, std::memory_order_relaxed); }
+
+    // Time since construction
+    clock::duration Elapsed() const noexcept { return clock::now() - startTime; }
+
+    // Stop reporting, waiting for any report being written to finish
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable()) thread.join();
+    }
+
+private:
+    void StartSamples()
+    {
+        window[0] = Sample{clock::now(), 0};
+        sampleCount = 1;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+        {
+            Report();
+        }
+    }
+
+    // Called with the mutex held
+    void Report()
+    {
+        using namespace std::chrono;
+
+        Sample now{clock::now(), done.load(std::memory_order_relaxed)};
+        if (sampleCount == WindowSize)
+        {
+            std::copy(window + 1, window + WindowSize, window);
+            --sampleCount;
+        }
+        window[sampleCount++] = now;
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1)
+             << "Progress [" << duration<double>(now.time - startTime).count() << " s]: " << stage;
+
+        if (total > 0)
+        {
+            Sample const& oldest = window[0];
+            double seconds = duration<double>(now.time - oldest.time).count();
+            double rate = seconds > 0 ? (now.done - oldest.done) / seconds : 0;
+
+            line << ", " << now.done << " of " << total << " " << unit
+                 << " (" << 100.0 * now.done / total << "%), "
+                 << std::setprecision(0) << rate << " " << unit << "/s";
+            if (rate > 0 && now.done < total)
+            {
+                line << ", about " << std::ceil((total - now.done) / rate) << " s left";
+            }
+        }
+
+        uint64_t bytes = bytesWritten.load(std::memory_order_relaxed);
+        if (bytes > 0) line << std::setprecision(1) << ", " << bytes / 1e6 << " MB written";
+
+        line << "\n";
+        log << line.str() << std::flush;
+    }
+};
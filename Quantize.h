@@ -0,0 +1,139 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+// Reduce a set of colors, each used by counts[i] pixels, to at most maxColors colors by
+// median cut.  Starting from one box holding every color, the box with the widest
+// extent in any of R, G, B, or A is repeatedly split at the pixel-weighted median of
+// that channel, until there are maxColors boxes or no box holds more than one color.
+// Each box is represented by the pixel-weighted mean of its colors.
+//
+// Returns, for each input color, the index of its representative in "reduced".
+
+inline std::vector<uint32_t> MedianCut(std::vector<RasterImage::RGBA> const& colors,
+    std::vector<uint64_t> const& counts, size_t maxColors, std::vector<RasterImage::RGBA>& reduced)
+{
+    using RGBA = RasterImage::RGBA;
+
+    auto channel = [](RGBA c, int k) -> int
+    {
+        return k == 0 ? c.r : k == 1 ? c.g : k == 2 ? c.b : c.a;
+    };
+
+    // Colors of a box are order[begin] to order[end - 1]
+    struct Box
+    {
+        size_t begin;
+        size_t end;
+        int widestChannel;
+        int extent;
+
+        bool operator<(Box const& other) const noexcept { return extent < other.extent; }
+    };
+
+    std::vector<uint32_t> order(colors.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = uint32_t(i);
+    }
+
+    auto makeBox = [&](size_t begin, size_t end)
+    {
+        int lo[4] = {255, 255, 255, 255};
+        int hi[4] = {0, 0, 0, 0};
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                int v = channel(colors[order[i]], k);
+                lo[k] = std::min(lo[k], v);
+                hi[k] = std::max(hi[k], v);
+            }
+        }
+
+        Box box{begin, end, 0, -1};
+        for (int k = 0; k < 4; ++k)
+        {
+            if (hi[k] - lo[k] > box.extent)
+            {
+                box.extent = hi[k] - lo[k];
+                box.widestChannel = k;
+            }
+        }
+        return box;
+    };
+
+    std::priority_queue<Box> boxes;
+    if (!colors.empty()) boxes.push(makeBox(0, colors.size()));
+
+    while (!boxes.empty() && boxes.size() < std::max<size_t>(1, maxColors))
+    {
+        // Colors are distinct, so if the widest box has no extent, every box has one color
+        Box box = boxes.top();
+        if (box.extent <= 0) break;
+        boxes.pop();
+
+        int k = box.widestChannel;
+        std::sort(order.begin() + box.begin, order.begin() + box.end, [&](uint32_t a, uint32_t b)
+        {
+            return channel(colors[a], k) < channel(colors[b], k);
+        });
+
+        uint64_t total = 0;
+        for (size_t i = box.begin; i < box.end; ++i)
+        {
+            total += counts[order[i]];
+        }
+
+        // Split after the weighted median, leaving at least one color on each side
+        uint64_t below = 0;
+        size_t split = box.begin + 1;
+        for (; split < box.end - 1; ++split)
+        {
+            below += counts[order[split - 1]];
+            if (2 * below >= total) break;
+        }
+
+        boxes.push(makeBox(box.begin, split));
+        boxes.push(makeBox(split, box.end));
+    }
+
+    std::vector<uint32_t> representative(colors.size());
+    reduced.clear();
+    for (; !boxes.empty(); boxes.pop())
+    {
+        Box const& box = boxes.top();
+        uint64_t sum[4] = {};
+        uint64_t total = 0;
+        for (size_t i = box.begin; i < box.end; ++i)
+        {
+            RGBA c = colors[order[i]];
+            uint64_t n = counts[order[i]];
+            sum[0] += c.r * n;
+            sum[1] += c.g * n;
+            sum[2] += c.b * n;
+            sum[3] += c.a * n;
+            total += n;
+            representative[order[i]] = uint32_t(reduced.size());
+        }
+
+        total = std::max<uint64_t>(total, 1);
+        auto mean = [&](int k) { return RasterImage::PixData_t((sum[k] + total / 2) / total); };
+        reduced.push_back(RGBA{mean(0), mean(1), mean(2), mean(3)});
+    }
+
+    return representative;
+}
@@ -1,12 +1,48 @@
-#define STBI_FAILURE_USERMSG
-#define STB_IMAGE_IMPLEMENTATION
+#pragma once
+
+// The implementations are in raster2vector_core.cpp
 #include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "MappedFile.h"
+#include "PixelConvert.h"
+
+#include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <memory>
 #include <string>
+#include <vector>
+
+// Allocate pixel data the way stb_image does, so stbi_image_free frees it.  Null if
+// the size doesn't fit in an int, which is stb_image's limit too.
+
+inline unsigned char* AllocatePixels(int width, int height, int channels) noexcept
+{
+    if (width < 0 || height < 0 || channels < 0) return nullptr;
+    uint64_t size = uint64_t(width) * uint64_t(height);
+    if (size > uint64_t(INT_MAX)) return nullptr;
+    size *= uint64_t(channels);
+    if (size > uint64_t(INT_MAX)) return nullptr;
+    return static_cast<unsigned char*>(malloc(size_t(size)));
+}
+
+// Pixel data of a RasterImage is either allocated by stb_image, or points into a mapped file
+
+struct RasterPixDataDeleter
+{
+    MappedFile* mapping;
+
+    RasterPixDataDeleter(MappedFile* mapping_ = nullptr) noexcept : mapping(mapping_) {}
+
+    void operator()(unsigned char* p) const noexcept
+    {
+        if (mapping) delete mapping;
+        else stbi_image_free(p);
+    }
+};
 
 class RasterImage
 {
@@ -14,12 +50,12 @@ public:
     using PixData_t = unsigned char;
 
 private:
-    using ptr_t = std::unique_ptr<PixData_t[], decltype(&stbi_image_free)>;
+    using ptr_t = std::unique_ptr<PixData_t[], RasterPixDataDeleter>;
 
     int width{};
     int height{};
     int channels{};
-    ptr_t img{nullptr, stbi_image_free};
+    ptr_t img;
     std::string failureMessage;
 
 public:
@@ -33,26 +69,59 @@ public:
     RasterImage(RasterImage&& other) noexcept = default;
     RasterImage& operator=(RasterImage&& other) noexcept = default;
 
+    // Load from a file.  The file is memory-mapped, and binary PNM files with 8-bit
+    // samples are used in place, without copying.  Other formats are decoded from the
+    // mapped file by stb_image.
+
     RasterImage(char const* inputFile)
-        : img(stbi_load(inputFile, &width, &height, &channels, 0), stbi_image_free)
-        , failureMessage(img ? "" : stbi_failure_reason())
     {
+        auto mapping = std::make_unique<MappedFile>(inputFile);
+        if (mapping->Valid() && UseMappedPnm(mapping)) return;
+
+        if (mapping->Valid() && mapping->Size() <= size_t(INT_MAX))
+        {
+            img = ptr_t(stbi_load_from_memory(mapping->Data(), int(mapping->Size()), &width, &height, &channels, 0));
+        }
+        else
+        {
+            img = ptr_t(stbi_load(inputFile, &width, &height, &channels, 0));
+        }
+
+        if (!img) failureMessage = stbi_failure_reason();
     }
 
     RasterImage(std::string const& inputFile) : RasterImage(inputFile.c_str()) {}
 
+    // Decode an image file's contents, already in memory, in any format stb_image reads
+
+    RasterImage(void const* data, size_t size)
+    {
+        if (size <= size_t(INT_MAX))
+        {
+            img = ptr_t(stbi_load_from_memory(static_cast<stbi_uc const*>(data), int(size), &width, &height, &channels, 0));
+            if (!img) failureMessage = stbi_failure_reason();
+        }
+        else
+        {
+            failureMessage = "Image data too large";
+        }
+    }
+
     RasterImage(int width_, int height_, int channels_)
         : width(width_)
         , height(height_)
         , channels(channels_)
-        , img((PixData_t*)stbi__malloc_mad3(width_, height_, channels_, 0), stbi_image_free)
+        , img(AllocatePixels(width_, height_, channels_))
         , failureMessage(img ? "" : "Out of memory")
     {
-        memset(img.get(), 0, width_ * height_ * channels_);
+        if (img) memset(img.get(), 0, SizeInBytes());
     }
 
     bool Valid() const noexcept { return bool(img); }
 
+    // True if pixel data is used in place from a memory-mapped file
+    bool IsMapped() const noexcept { return img.get_deleter().mapping != nullptr; }
+
     // Error message from last attempt to load or create an image.
     // Empty if there was no error.
     std::string const& FailureReason() const noexcept { return failureMessage; }
@@ -93,6 +162,65 @@ public:
 
     bool Load(std::string const& inputFile) noexcept { return Load(inputFile.c_str()); }
 
+    // Load every frame of an animated GIF, as RGBA images of the same size, along with
+    // the delay after each frame in milliseconds.  stb_image composes each frame over
+    // the previous ones, so every frame is a complete picture.  Any other file loads as
+    // a single frame, with a delay of 0.  Returns no frames if the file can't be loaded,
+    // with the reason in failureReason.
+
+    static std::vector<RasterImage> LoadFrames(char const* inputFile, std::vector<int>& delaysMs,
+        std::string& failureReason)
+    {
+        std::vector<RasterImage> frames;
+        delaysMs.clear();
+
+        MappedFile mapping(inputFile);
+        bool isGif = mapping.Valid() && mapping.Size() >= 6 && mapping.Size() <= size_t(INT_MAX)
+            && memcmp(mapping.Data(), "GIF8", 4) == 0;
+        if (!isGif)
+        {
+            RasterImage single{inputFile};
+            failureReason = single.FailureReason();
+            if (single.Valid())
+            {
+                frames.push_back(std::move(single));
+                delaysMs.push_back(0);
+            }
+            return frames;
+        }
+
+        int width = 0, height = 0, count = 0, channels = 0;
+        int* delays = nullptr;
+        stbi_uc* all = stbi_load_gif_from_memory(mapping.Data(), int(mapping.Size()), &delays,
+                                                 &width, &height, &count, &channels, 4);
+        if (!all)
+        {
+            failureReason = stbi_failure_reason();
+            return frames;
+        }
+
+        // Frames are laid out one after another, so each is copied out to stand alone
+        size_t const frameSize = size_t(width) * height * 4;
+        for (int f = 0; f < count; ++f)
+        {
+            RasterImage frame{width, height, 4};
+            if (!frame.Valid())
+            {
+                frames.clear();
+                delaysMs.clear();
+                failureReason = frame.FailureReason();
+                break;
+            }
+            memcpy(frame.img.get(), all + f * frameSize, frameSize);
+            frames.push_back(std::move(frame));
+            delaysMs.push_back(delays ? delays[f] : 0);
+        }
+
+        stbi_image_free(all);
+        stbi_image_free(delays);
+        return frames;
+    }
+
     // Write current image data to a BMP file
 
     bool SaveBmp(char const* outputFile) const noexcept
@@ -121,85 +249,34 @@ public:
         return temp;
     }
 
-    // Conversions that create a new RasterImage in a different format
+    // Copy of a rectangle of the image, which must lie within it
 
-    RasterImage AsRGB() const noexcept
+    RasterImage Crop(int col, int row, int width_, int height_) const noexcept
     {
-        RasterImage temp{width, height, 3};
-
-        switch (channels)
+        RasterImage temp{width_, height_, channels};
+        if (!img || !temp.img) return temp;
+        for (int r = 0; r < height_; ++r)
         {
-        case 1: // gray
-        case 2: // gray, alpha
-            // Assign gray value to R, G, and B -- ignore alpha
-            for (int row = 0; row < height; ++row)
-            {
-                for (int col = 0; col < width; ++col)
-                {
-                    auto* in = Pixel(row, col);
-                    auto* out = temp.Pixel(row, col);
-                    out[0] = in[0];
-                    out[1] = in[0];
-                    out[2] = in[0];
-                }
-            }
-            break;
-        case 3: // red, green, blue
-        case 4: // red, green, blue, alpha
-            // Copy R, G, and B values -- ignore alpha
-            for (int row = 0; row < height; ++row)
-            {
-                for (int col = 0; col < width; ++col)
-                {
-                    auto* in = Pixel(row, col);
-                    auto* out = temp.Pixel(row, col);
-                    out[0] = in[0];
-                    out[1] = in[1];
-                    out[2] = in[2];
-                }
-            }
-            break;
-        // default: Undefined behavior
+            memcpy(temp.Pixel(r, 0), Pixel(row + r, col), temp.RowSizeInBytes());
         }
+        return temp;
+    }
+
+    // Conversions that create a new RasterImage in a different format
 
+    RasterImage AsRGB() const noexcept
+    {
+        // Gray is assigned to R, G, and B, and alpha is ignored
+        RasterImage temp{width, height, 3};
+        if (img && temp.img) ConvertPixelsToRGB(img.get(), channels, temp.img.get(), size_t(width) * height);
         return temp;
     }
 
     RasterImage AsGrayscale() const noexcept
     {
+        // Brightness is the average of R, G, and B, and alpha is ignored
         RasterImage temp{width, height, 1};
-
-        switch (channels)
-        {
-        case 1: // gray
-        case 2: // gray, alpha
-            // Copy brightness values -- ignore alpha
-            for (int row = 0; row < height; ++row)
-            {
-                for (int col = 0; col < width; ++col)
-                {
-                    auto* in = Pixel(row, col);
-                    auto* out = temp.Pixel(row, col);
-                    out[0] = in[0];
-                }
-            }
-            break;
-        case 3: // red, green, blue
-        case 4: // red, green, blue, alpha
-            // Set brightness to average of R, G, and B -- ignore alpha
-            for (int row = 0; row < height; ++row)
-            {
-                for (int col = 0; col < width; ++col)
-                {
-                    auto* in = Pixel(row, col);
-                    auto* out = temp.Pixel(row, col);
-                    out[0] = ToGrayscale(RGB{in[0], in[1], in[2]});
-                }
-            }
-            break;
-        // default: Undefined behavior
-        }
-
+        if (img && temp.img) ConvertPixelsToGray(img.get(), channels, temp.img.get(), size_t(width) * height);
         return temp;
     }
 
@@ -225,7 +302,8 @@ public:
     int Height() const noexcept { return height; }
     int ChannelCount() const noexcept { return channels; }
     
-    int SizeInBytes() const noexcept { return width * height * channels; }
+    size_t SizeInBytes() const noexcept { return size_t(width) * height * channels; }
+    size_t RowSizeInBytes() const noexcept { return size_t(width) * channels; }
 
     bool HasColor() const noexcept { return channels >= 3; }
     bool HasAlpha() const noexcept { return channels == 2 || channels == 4; }
@@ -252,13 +330,13 @@ public:
 
     PixData_t* Pixel(int row, int col) noexcept
     {
-        int index = row * width + col;
+        size_t index = size_t(row) * width + col;
         return &img[index * channels];
     };
 
     PixData_t const* Pixel(int row, int col) const noexcept
     {
-        int index = row * width + col;
+        size_t index = size_t(row) * width + col;
         return &img[index * channels];
     };
 
@@ -289,6 +367,9 @@ public:
         PixData_t a;
     };
 
+    // Row conversions treat arrays of these as plain bytes
+    static_assert(sizeof(RGB) == 3 && sizeof(RGBA) == 4, "Pixel structs must not be padded");
+
     // Pixel data conversion helpers
 
     static PixData_t ToGrayscale(RGB v) noexcept
@@ -341,7 +422,13 @@ public:
 
     RGBA GetPixelRGBA(int row, int col) const noexcept
     {
-        auto* p = Pixel(row, col);
+        return ToRGBA(Pixel(row, col), channels);
+    };
+
+    // Convert pixel data in any format to RGBA
+
+    static RGBA ToRGBA(PixData_t const* p, int channels) noexcept
+    {
         switch (channels)
         {
         case 1: // gray
@@ -358,6 +445,14 @@ public:
         }
     };
 
+    // Read a whole row of pixel data, converting format if necessary.
+    // "dst" must have room for Width() pixels.
+
+    void GetRowRGBA(int row, RGBA* dst) const noexcept
+    {
+        ConvertPixelsToRGBA(Pixel(row, 0), channels, reinterpret_cast<PixData_t*>(dst), size_t(width));
+    }
+
     RGBA GetPixelRGBAClamped(int row, int col) const noexcept
     {
         return GetPixelRGBA(ClampRow(row), ClampCol(col));
@@ -428,4 +523,69 @@ public:
     {
         SetPixelRGBA(ClampRow(row), ClampCol(col), val);
     }
+
+    // Parse the header of a binary PNM file (P5 gray or P6 RGB) with 8-bit samples,
+    // returning the offset of the pixel data, or 0 if the file isn't one.  "data" only
+    // needs to hold the header; the caller checks that the pixel data is all there.
+
+    static size_t ParsePnmHeader(PixData_t const* data, size_t size, int& w, int& h, int& c) noexcept
+    {
+        if (size < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) return 0;
+        c = data[1] == '5' ? 1 : 3;
+
+        size_t pos = 2;
+        int fields[3];
+        for (int& field : fields)
+        {
+            // Skip whitespace and comments
+            while (pos < size && (isspace(data[pos]) || data[pos] == '#'))
+            {
+                if (data[pos] == '#')
+                    while (pos < size && data[pos] != '\n') ++pos;
+                else
+                    ++pos;
+            }
+
+            // Stop before the value can overflow, rather than after
+            if (pos >= size || !isdigit(data[pos])) return 0;
+            int value = 0;
+            while (pos < size && isdigit(data[pos]))
+            {
+                int digit = data[pos++] - '0';
+                if (value > (INT_MAX - digit) / 10) return 0;
+                value = value * 10 + digit;
+            }
+            if (value <= 0) return 0;
+            field = value;
+        }
+
+        // Exactly one whitespace char separates the header from the data
+        if (pos >= size || !isspace(data[pos])) return 0;
+        ++pos;
+
+        w = fields[0];
+        h = fields[1];
+        if (fields[2] != 255) return 0; // Needs conversion, so leave it to stb_image
+
+        return pos;
+    }
+
+private:
+
+    // Use pixel data straight from a mapped PNM file, taking ownership of the mapping
+
+    bool UseMappedPnm(std::unique_ptr<MappedFile>& mapping) noexcept
+    {
+        int w, h, c;
+        size_t offset = ParsePnmHeader(mapping->Data(), mapping->Size(), w, h, c);
+        if (offset == 0) return false;
+        if ((mapping->Size() - offset) / size_t(w) / size_t(h) < size_t(c)) return false;
+
+        width = w;
+        height = h;
+        channels = c;
+        PixData_t* pixels = mapping->Data() + offset;
+        img = ptr_t(pixels, RasterPixDataDeleter{mapping.release()});
+        return true;
+    }
 };
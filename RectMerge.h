@@ -0,0 +1,293 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+#include "ProgressReporter.h"
+
+#include <string.h>
+#include <algorithm>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+// Compare two pixels of the given format for exact equality
+
+inline bool SamePixel(RasterImage::PixData_t const* a, RasterImage::PixData_t const* b, int channels) noexcept
+{
+    switch (channels)
+    {
+    case 4: if (a[3] != b[3]) return false; // fall through
+    case 3: if (a[2] != b[2]) return false; // fall through
+    case 2: if (a[1] != b[1]) return false; // fall through
+    case 1: return a[0] == b[0];
+    default:
+        // Undefined behavior
+        return false;
+    }
+}
+
+// Same, for a channel count known at compile time, which compiles to a single compare
+// for most formats
+
+template <int Channels>
+inline bool SamePixel(RasterImage::PixData_t const* a, RasterImage::PixData_t const* b) noexcept
+{
+    return memcmp(a, b, Channels) == 0;
+}
+
+// Call f(std::integral_constant<int, channels>()), so that f can be instantiated for
+// each channel count, and pick the right one once for a whole image rather than
+// switching on the channel count for every pixel
+
+template <typename F>
+decltype(auto) WithChannelCount(int channels, F&& f)
+{
+    switch (channels)
+    {
+    case 1:  return f(std::integral_constant<int, 1>());
+    case 2:  return f(std::integral_constant<int, 2>());
+    case 3:  return f(std::integral_constant<int, 3>());
+    default: return f(std::integral_constant<int, 4>()); // Undefined behavior unless 4
+    }
+}
+
+// Scan one row of pixels, calling emit(colBegin, colEnd) for each horizontal run
+// of identical pixels, from left to right.  Runs cover the whole row.
+
+template <int Channels, typename Emit>
+void ForEachRun(RasterImage::PixData_t const* row, int width, Emit&& emit)
+{
+    if (width <= 0) return;
+
+    auto const* p = row;
+    auto const* runPixel = p;
+    int runBegin = 0;
+
+    for (int col = 1; col < width; ++col)
+    {
+        p += Channels;
+        if (!SamePixel<Channels>(p, runPixel))
+        {
+            emit(runBegin, col);
+            runBegin = col;
+            runPixel = p;
+        }
+    }
+
+    emit(runBegin, width);
+}
+
+template <typename Emit>
+void ForEachRun(RasterImage::PixData_t const* row, int width, int channels, Emit&& emit)
+{
+    WithChannelCount(channels, [&](auto channelCount)
+    {
+        ForEachRun<decltype(channelCount)::value>(row, width, emit);
+    });
+}
+
+template <int Channels, typename Emit>
+void ForEachRun(RasterImage const& img, int row, Emit&& emit)
+{
+    if (img.Width() <= 0) return;
+    ForEachRun<Channels>(img.Pixel(row, 0), img.Width(), emit);
+}
+
+template <typename Emit>
+void ForEachRun(RasterImage const& img, int row, Emit&& emit)
+{
+    if (img.Width() <= 0) return;
+    ForEachRun(img.Pixel(row, 0), img.Width(), img.ChannelCount(), emit);
+}
+
+// A rectangle of identically-colored pixels, in pixel coordinates.  The merge functions
+// below allocate their results, and their scratch space, from "memory", which may be
+// an arena for the whole conversion.  Given a reporter, they advance it by a row for
+// each row of the image they finish.
+
+struct ColorRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Count the horizontal runs of identical pixels, which the rectangle lists below are
+// reserved for, so they're allocated once rather than grown
+
+template <int Channels>
+size_t CountRuns(RasterImage const& img) noexcept
+{
+    size_t count = 0;
+    for (int row = 0; row < img.Height(); ++row)
+    {
+        ForEachRun<Channels>(img, row, [&](int, int) { ++count; });
+    }
+    return count;
+}
+
+// Collect every horizontal run of identical pixels as a rectangle of height 1, in
+// raster order
+
+template <int Channels>
+std::pmr::vector<ColorRect> CollectRuns(RasterImage const& img, std::pmr::memory_resource* memory, ProgressReporter* progress)
+{
+    std::pmr::vector<ColorRect> runs(memory);
+    runs.reserve(CountRuns<Channels>(img));
+    for (int row = 0; row < img.Height(); ++row)
+    {
+        ForEachRun<Channels>(img, row, [&](int colBegin, int colEnd)
+        {
+            runs.push_back(ColorRect{colBegin, row, colEnd - colBegin, 1});
+        });
+        if (progress) progress->Advance(1);
+    }
+    return runs;
+}
+
+inline std::pmr::vector<ColorRect> CollectRuns(RasterImage const& img,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource(), ProgressReporter* progress = nullptr)
+{
+    return WithChannelCount(img.ChannelCount(), [&](auto c) { return CollectRuns<decltype(c)::value>(img, memory, progress); });
+}
+
+// Merge horizontal runs vertically: a run continues the rectangle above it when it
+// starts and ends at the same columns and has the same color.  Rectangles are
+// returned in order of their top-left corners, row by row.
+
+template <int Channels>
+std::pmr::vector<ColorRect> MergeRunsVertically(RasterImage const& img, std::pmr::memory_resource* memory,
+    ProgressReporter* progress)
+{
+    std::pmr::vector<ColorRect> done(memory);
+    std::pmr::vector<ColorRect> open(memory);     // Rectangles that reached the previous row, by column
+    std::pmr::vector<ColorRect> nextOpen(memory);
+
+    // Each rectangle is made of at least one run, and a row has at most one per pixel
+    done.reserve(CountRuns<Channels>(img));
+    open.reserve(size_t(img.Width()));
+    nextOpen.reserve(size_t(img.Width()));
+
+    for (int row = 0; row < img.Height(); ++row)
+    {
+        nextOpen.clear();
+        size_t i = 0;
+
+        ForEachRun<Channels>(img, row, [&](int colBegin, int colEnd)
+        {
+            // Rectangles left of this run can't be continued by this row
+            while (i < open.size() && open[i].x < colBegin)
+            {
+                done.push_back(open[i++]);
+            }
+
+            if (i < open.size()
+                && open[i].x == colBegin
+                && open[i].w == colEnd - colBegin
+                && SamePixel<Channels>(img.Pixel(open[i].y, colBegin), img.Pixel(row, colBegin)))
+            {
+                ColorRect rect = open[i++];
+                ++rect.h;
+                nextOpen.push_back(rect);
+            }
+            else
+            {
+                nextOpen.push_back(ColorRect{colBegin, row, colEnd - colBegin, 1});
+            }
+        });
+
+        while (i < open.size())
+        {
+            done.push_back(open[i++]);
+        }
+        open.swap(nextOpen);
+        if (progress) progress->Advance(1);
+    }
+
+    done.insert(done.end(), open.begin(), open.end());
+
+    std::sort(done.begin(), done.end(), [](ColorRect const& a, ColorRect const& b)
+    {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+
+    return done;
+}
+
+inline std::pmr::vector<ColorRect> MergeRunsVertically(RasterImage const& img,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource(), ProgressReporter* progress = nullptr)
+{
+    return WithChannelCount(img.ChannelCount(), [&](auto c) { return MergeRunsVertically<decltype(c)::value>(img, memory, progress); });
+}
+
+// Greedy maximal-rectangle decomposition: in raster order, each pixel not yet covered
+// starts a rectangle that is grown as far right as possible, then as far down as the
+// whole width still matches.  Rectangles are returned in order of their top-left
+// corners, row by row.
+
+template <int Channels>
+std::pmr::vector<ColorRect> MergeGreedyRects(RasterImage const& img, std::pmr::memory_resource* memory,
+    ProgressReporter* progress)
+{
+    int const width = img.Width();
+    int const height = img.Height();
+
+    std::pmr::vector<ColorRect> rects(memory);
+    std::pmr::vector<unsigned char> covered(size_t(width) * height, memory);
+    auto isCovered = [&](int row, int col) -> unsigned char& { return covered[size_t(row) * width + col]; };
+
+    // There are usually fewer rectangles than runs, though not always
+    rects.reserve(CountRuns<Channels>(img));
+
+    for (int row = 0; row < height; ++row)
+    {
+        for (int col = 0; col < width; ++col)
+        {
+            if (isCovered(row, col)) continue;
+
+            auto const* color = img.Pixel(row, col);
+
+            int colEnd = col + 1;
+            while (colEnd < width && !isCovered(row, colEnd) && SamePixel<Channels>(img.Pixel(row, colEnd), color))
+            {
+                ++colEnd;
+            }
+
+            int rowEnd = row + 1;
+            for (; rowEnd < height; ++rowEnd)
+            {
+                bool match = true;
+                for (int c = col; c < colEnd && match; ++c)
+                {
+                    match = !isCovered(rowEnd, c) && SamePixel<Channels>(img.Pixel(rowEnd, c), color);
+                }
+                if (!match) break;
+            }
+
+            for (int r = row; r < rowEnd; ++r)
+            {
+                memset(&isCovered(r, col), 1, colEnd - col);
+            }
+
+            rects.push_back(ColorRect{col, row, colEnd - col, rowEnd - row});
+            col = colEnd - 1;
+        }
+        if (progress) progress->Advance(1);
+    }
+
+    return rects;
+}
+
+inline std::pmr::vector<ColorRect> MergeGreedyRects(RasterImage const& img,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource(), ProgressReporter* progress = nullptr)
+{
+    return WithChannelCount(img.ChannelCount(), [&](auto c) { return MergeGreedyRects<decltype(c)::value>(img, memory, progress); });
+}
@@ -0,0 +1,239 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+#include "RectMerge.h"
+
+#include <stdint.h>
+#include <memory_resource>
+#include <vector>
+
+// Integer point on the pixel grid, where (x, y) is the top-left corner of pixel (row y, col x)
+
+struct GridPoint
+{
+    int x;
+    int y;
+};
+
+// Outline of one 4-connected region of identical pixels.  The outer boundary and the
+// boundaries of any holes are stored as closed loops of corner vertices, with
+// collinear vertices removed.  Loops are concatenated in "points", and loopEnds holds
+// the end index of each loop.  Since loops never cross, filling with the even-odd
+// rule gives exactly the region's pixels.
+//
+// Outlines are allocator-aware, so a vector of them allocated from an arena allocates
+// every outline's points from it too, instead of making two heap allocations (or more)
+// per region.
+
+struct RegionOutline
+{
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    int row{-1};  // A pixel in the region, for looking up its color
+    int col{-1};
+    std::pmr::vector<GridPoint> points;
+    std::pmr::vector<uint32_t> loopEnds;
+
+    RegionOutline() = default;
+    explicit RegionOutline(allocator_type alloc) : points(alloc), loopEnds(alloc) {}
+
+    RegionOutline(RegionOutline const& other, allocator_type alloc)
+        : row(other.row), col(other.col), points(other.points, alloc), loopEnds(other.loopEnds, alloc) {}
+
+    RegionOutline(RegionOutline&& other, allocator_type alloc)
+        : row(other.row), col(other.col), points(std::move(other.points), alloc), loopEnds(std::move(other.loopEnds), alloc) {}
+};
+
+// Assign each pixel the index of its 4-connected region of identical pixels.
+// Regions are numbered in raster order of their first pixel.  Labels and scratch
+// space are allocated from "memory".  Given a reporter, it's advanced by a row for
+// each row of seeds done.
+
+template <int Channels>
+std::pmr::vector<uint32_t> LabelRegions(RasterImage const& img, uint32_t& regionCount, std::pmr::memory_resource* memory,
+    ProgressReporter* progress)
+{
+    int const width = img.Width();
+    int const height = img.Height();
+    uint32_t const unlabeled = UINT32_MAX;
+
+    std::pmr::vector<uint32_t> labels(size_t(width) * height, unlabeled, memory);
+    std::pmr::vector<size_t> stack(memory);
+    regionCount = 0;
+
+    for (int seedRow = 0; seedRow < height; ++seedRow)
+    {
+        for (int seedCol = 0; seedCol < width; ++seedCol)
+        {
+            size_t seed = size_t(seedRow) * width + seedCol;
+            if (labels[seed] != unlabeled) continue;
+
+            uint32_t label = regionCount++;
+            auto const* color = img.Pixel(seedRow, seedCol);
+
+            labels[seed] = label;
+            stack.push_back(seed);
+            while (!stack.empty())
+            {
+                size_t i = stack.back();
+                stack.pop_back();
+                int row = int(i / width);
+                int col = int(i % width);
+
+                auto visit = [&](int r, int c)
+                {
+                    size_t j = size_t(r) * width + c;
+                    if (labels[j] == unlabeled && SamePixel<Channels>(img.Pixel(r, c), color))
+                    {
+                        labels[j] = label;
+                        stack.push_back(j);
+                    }
+                };
+
+                if (col > 0)          visit(row, col - 1);
+                if (col < width - 1)  visit(row, col + 1);
+                if (row > 0)          visit(row - 1, col);
+                if (row < height - 1) visit(row + 1, col);
+            }
+        }
+        if (progress) progress->Advance(1);
+    }
+
+    return labels;
+}
+
+inline std::pmr::vector<uint32_t> LabelRegions(RasterImage const& img, uint32_t& regionCount,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource(), ProgressReporter* progress = nullptr)
+{
+    return WithChannelCount(img.ChannelCount(), [&](auto c)
+    {
+        return LabelRegions<decltype(c)::value>(img, regionCount, memory, progress);
+    });
+}
+
+// Trace the outlines of all regions along pixel edges.  Outlines are returned in region
+// label order, allocated from "memory" along with all scratch space.  Given a
+// reporter, labeling and then tracing are reported to it as stages counted in rows.
+//
+// Each loop is walked clockwise (in image coordinates, with y down) keeping the region
+// on the right-hand side.  At each vertex, the two pixels ahead decide the next edge:
+// if the pixel straight ahead is outside the region, turn right; if it is inside and
+// the pixel ahead and to the left is also inside, turn left; otherwise continue
+// straight.  Preferring the right turn keeps diagonally-touching pixels in separate
+// loops, as 4-connectivity requires.  Every loop contains at least one eastbound edge,
+// along the top side of a region pixel, so loops are started from unvisited top edges
+// found in raster order, which are always at a corner.
+
+inline std::pmr::vector<RegionOutline> TraceRegions(RasterImage const& img,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource(), ProgressReporter* progress = nullptr)
+{
+    int const width = img.Width();
+    int const height = img.Height();
+
+    if (progress) progress->Stage("labeling regions", uint64_t(height), "rows");
+    uint32_t regionCount = 0;
+    std::pmr::vector<uint32_t> labels = LabelRegions(img, regionCount, memory, progress);
+    if (progress) progress->Stage("tracing regions", uint64_t(height), "rows");
+    std::pmr::vector<RegionOutline> regions(regionCount, memory);
+    std::pmr::vector<unsigned char> topVisited(labels.size(), memory);
+
+    // Each loop is traced into scratch space first, so the region's points can be
+    // allocated at their final size
+    std::pmr::vector<GridPoint> loop(memory);
+    loop.reserve(size_t(2) * (width + height));
+
+    auto labelAt = [&](int row, int col) -> uint32_t
+    {
+        return (row < 0 || row >= height || col < 0 || col >= width)
+            ? UINT32_MAX
+            : labels[size_t(row) * width + col];
+    };
+
+    // Directions, clockwise: east, south, west, north
+    static constexpr int dRow[4] = {0, 1, 0, -1};
+    static constexpr int dCol[4] = {1, 0, -1, 0};
+
+    // Starting vertex of the edge along side (d - 1) of pixel (row, col), walked in direction d
+    auto corner = [](int row, int col, int d)
+    {
+        switch (d)
+        {
+        case 0:  return GridPoint{col,     row    };
+        case 1:  return GridPoint{col + 1, row    };
+        case 2:  return GridPoint{col + 1, row + 1};
+        default: return GridPoint{col,     row + 1};
+        }
+    };
+
+    for (int row = 0; row < height; ++row)
+    {
+        for (int col = 0; col < width; ++col)
+        {
+            size_t i = size_t(row) * width + col;
+            uint32_t label = labels[i];
+            RegionOutline& region = regions[label];
+
+            if (region.row < 0)
+            {
+                region.row = row;
+                region.col = col;
+            }
+
+            if (topVisited[i] || labelAt(row - 1, col) == label) continue;
+
+            int r = row;
+            int c = col;
+            int d = 0;
+            loop.clear();
+            for (;;)
+            {
+                loop.push_back(corner(r, c, d));
+
+                // Follow edges in direction d until the boundary turns
+                for (;;)
+                {
+                    if (d == 0) topVisited[size_t(r) * width + c] = 1;
+
+                    int aheadRow = r + dRow[d];
+                    int aheadCol = c + dCol[d];
+                    if (labelAt(aheadRow, aheadCol) != label)
+                    {
+                        d = (d + 1) & 3;
+                        break;
+                    }
+
+                    int left = (d + 3) & 3;
+                    int leftRow = aheadRow + dRow[left];
+                    int leftCol = aheadCol + dCol[left];
+                    if (labelAt(leftRow, leftCol) == label)
+                    {
+                        r = leftRow;
+                        c = leftCol;
+                        d = left;
+                        break;
+                    }
+
+                    r = aheadRow;
+                    c = aheadCol;
+                }
+
+                if (r == row && c == col && d == 0) break;
+            }
+
+            region.points.reserve(region.points.size() + loop.size());
+            region.points.insert(region.points.end(), loop.begin(), loop.end());
+            region.loopEnds.push_back(uint32_t(region.points.size()));
+        }
+        if (progress) progress->Advance(1);
+    }
+
+    return regions;
+}
@@ -0,0 +1,580 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "RasterImage.h"
+#include "Inflate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Source of an image's pixel data, read from top to bottom a few rows at a time, so
+// an image can be converted without ever holding all of it in memory.  Rows use
+// the same pixel format as RasterImage.
+
+class RasterRowSource
+{
+protected:
+    int width{};
+    int height{};
+    int channels{};
+    int nextRow{};
+    std::string failureMessage;
+
+public:
+    using PixData_t = RasterImage::PixData_t;
+
+    virtual ~RasterRowSource() = default;
+
+    int Width() const noexcept { return width; }
+    int Height() const noexcept { return height; }
+    int ChannelCount() const noexcept { return channels; }
+    size_t RowSizeInBytes() const noexcept { return size_t(width) * channels; }
+
+    // Error message from opening or reading the image.  Empty if there was no error.
+    std::string const& FailureReason() const noexcept { return failureMessage; }
+
+    bool Valid() const noexcept { return failureMessage.empty(); }
+
+    // Read the next rowCount rows, returning their pixel data, which is contiguous.
+    // The data is either stored in "buffer" or owned by the source, and stays valid
+    // until "buffer" is modified or the source is destroyed.  Returns null on failure.
+
+    virtual PixData_t const* ReadRows(int rowCount, std::vector<PixData_t>& buffer) = 0;
+
+    // Another source reading the same image from its first row, for reading it twice, as
+    // counting the output before converting does.  Null if that would cost about as much
+    // as converting, like inflating a PNG file twice, or if it can't be opened again.
+
+    virtual std::unique_ptr<RasterRowSource> Reopen() const { return nullptr; }
+};
+
+// Rows of a whole image that is already in memory
+
+class ImageRowSource : public RasterRowSource
+{
+    RasterImage owned;
+    RasterImage const* image;
+
+public:
+    // Read rows of an image owned by the caller
+    explicit ImageRowSource(RasterImage const& img) noexcept : image(&img)
+    {
+        width = img.Width();
+        height = img.Height();
+        channels = img.ChannelCount();
+        failureMessage = img.FailureReason();
+    }
+
+    // Read rows of an image owned by the source
+    explicit ImageRowSource(RasterImage&& img) noexcept : ImageRowSource(static_cast<RasterImage const&>(img))
+    {
+        owned = std::move(img);
+        image = &owned;
+    }
+
+    PixData_t const* ReadRows(int rowCount, std::vector<PixData_t>&) override
+    {
+        if (rowCount <= 0 || rowCount > height - nextRow) return nullptr;
+
+        PixData_t const* rows = image->Pixel(nextRow, 0);
+        nextRow += rowCount;
+        return rows;
+    }
+
+    // The image stays this source's, so this source must outlive the new one
+    std::unique_ptr<RasterRowSource> Reopen() const override
+    {
+        return std::make_unique<ImageRowSource>(*image);
+    }
+};
+
+// Rows of a binary PNM file with 8-bit samples, read from the file as needed
+
+class PnmRowSource : public RasterRowSource
+{
+    std::string path;
+    FILE* file{};
+
+public:
+    PnmRowSource(PnmRowSource const& other) = delete;
+    PnmRowSource& operator=(PnmRowSource const& other) = delete;
+
+    explicit PnmRowSource(char const* fileName) : path(fileName)
+    {
+        std::error_code ec;
+        auto fileSize = std::filesystem::file_size(fileName, ec);
+        file = fopen(fileName, "rb");
+        if (ec || !file)
+        {
+            failureMessage = "Can't open file";
+            return;
+        }
+
+        // Headers are tiny, but may contain comments
+        PixData_t header[4096];
+        size_t headerSize = fread(header, 1, sizeof(header), file);
+        size_t offset = RasterImage::ParsePnmHeader(header, headerSize, width, height, channels);
+        if (offset == 0)
+        {
+            failureMessage = "Not a binary PNM file with 8-bit samples";
+            return;
+        }
+
+        if ((fileSize - offset) / size_t(width) / size_t(height) < size_t(channels)
+            || fseek(file, long(offset), SEEK_SET) != 0)
+        {
+            failureMessage = "File is truncated";
+        }
+    }
+
+    ~PnmRowSource() override
+    {
+        if (file) fclose(file);
+    }
+
+    // True if the file starts like a PNM file that PnmRowSource can read
+    static bool CanRead(char const* fileName) noexcept
+    {
+        PixData_t magic[2]{};
+        FILE* f = fopen(fileName, "rb");
+        if (!f) return false;
+        bool pnm = fread(magic, 1, 2, f) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+        fclose(f);
+        return pnm;
+    }
+
+    std::unique_ptr<RasterRowSource> Reopen() const override
+    {
+        auto again = std::make_unique<PnmRowSource>(path.c_str());
+        if (!again->Valid()) return nullptr;
+        return again;
+    }
+
+    PixData_t const* ReadRows(int rowCount, std::vector<PixData_t>& buffer) override
+    {
+        if (!file || rowCount <= 0 || rowCount > height - nextRow) return nullptr;
+
+        size_t bytes = size_t(rowCount) * RowSizeInBytes();
+        buffer.resize(bytes);
+        if (fread(buffer.data(), 1, bytes, file) != bytes)
+        {
+            failureMessage = "File is truncated";
+            return nullptr;
+        }
+
+        nextRow += rowCount;
+        return buffer.data();
+    }
+};
+
+// Rows of a PNG file, inflated and unfiltered a scanline at a time as they're read, so
+// only the rows being converted and the 32 KB inflate window are in memory.  Pixels
+// come out exactly as stb_image decodes them: 16-bit samples are cut to their high
+// byte, gray of fewer bits is scaled to 8, palettes are expanded, and tRNS adds an
+// alpha channel.  Interlaced files, and Apple's CgBI variant, aren't read, so they
+// fail to open.
+
+class PngRowSource : public RasterRowSource
+{
+    FILE* file{};
+    uint32_t chunkLeft = 0; // Of the current IDAT chunk
+    bool dataEnded = false;
+    Inflater inflater;
+
+    int depth = 0;
+    int colorType = 0;
+    int bytesPerPixel = 1;  // Of the filtered data, rounded up to 1
+    size_t scanlineSize = 0;
+    std::vector<unsigned char> scanline;  // Filter type and samples of the current row
+    std::vector<unsigned char> previous;  // Unfiltered samples of the row above
+
+    PixData_t palette[256][4] = {};
+    bool hasTransparency = false;
+    uint16_t transparent[3] = {};         // Dropped to 8 bits, and scaled, for depths under 16
+
+public:
+    PngRowSource(PngRowSource const& other) = delete;
+    PngRowSource& operator=(PngRowSource const& other) = delete;
+
+    explicit PngRowSource(char const* fileName)
+        : inflater([this](unsigned char* data, size_t size) { return FillData(data, size); })
+    {
+        file = fopen(fileName, "rb");
+        if (!file)
+        {
+            failureMessage = "Can't open file";
+            return;
+        }
+
+        unsigned char signature[8];
+        uint32_t length;
+        uint32_t type;
+        if (fread(signature, 1, 8, file) != 8 || memcmp(signature, Signature, 8) != 0
+            || !ReadChunkHeader(length, type) || type != ChunkType("IHDR") || length != 13)
+        {
+            failureMessage = "Not a PNG file";
+            return;
+        }
+
+        unsigned char header[13];
+        if (fread(header, 1, 13, file) != 13 || !Skip(4))
+        {
+            failureMessage = "File is truncated";
+            return;
+        }
+        uint32_t w = Get32(header);
+        uint32_t h = Get32(header + 4);
+        depth = header[8];
+        colorType = header[9];
+        if (w == 0 || h == 0 || w > MaxDimension || h > MaxDimension)
+        {
+            failureMessage = "Bad image size";
+            return;
+        }
+        if (!ValidDepth() || header[10] != 0 || header[11] != 0)
+        {
+            failureMessage = "Bad PNG format";
+            return;
+        }
+        if (header[12] != 0)
+        {
+            failureMessage = "Interlaced PNG files are decoded whole";
+            return;
+        }
+        width = int(w);
+        height = int(h);
+
+        // Indexes past the end of the palette come out opaque black
+        for (auto& entry : palette)
+        {
+            entry[3] = 255;
+        }
+
+        int paletteSize = 0;
+        for (;;)
+        {
+            if (!ReadChunkHeader(length, type))
+            {
+                failureMessage = "File is truncated";
+                return;
+            }
+            if (type == ChunkType("IDAT"))
+            {
+                chunkLeft = length;
+                break;
+            }
+            if (type == ChunkType("IEND") || type == ChunkType("CgBI"))
+            {
+                failureMessage = type == ChunkType("IEND") ? "No image data" : "CgBI PNG files are decoded whole";
+                return;
+            }
+
+            if (type == ChunkType("PLTE") || type == ChunkType("tRNS"))
+            {
+                unsigned char data[768];
+                if (length > sizeof(data) || fread(data, 1, length, file) != length)
+                {
+                    failureMessage = "Bad PNG chunk";
+                    return;
+                }
+                if (type == ChunkType("PLTE"))
+                {
+                    paletteSize = int(length / 3);
+                    for (int i = 0; i < paletteSize; ++i)
+                    {
+                        palette[i][0] = data[3 * i];
+                        palette[i][1] = data[3 * i + 1];
+                        palette[i][2] = data[3 * i + 2];
+                        palette[i][3] = 255;
+                    }
+                }
+                else if (!ReadTransparency(data, length, paletteSize))
+                {
+                    failureMessage = "Bad PNG transparency";
+                    return;
+                }
+                length = 0;
+            }
+            if (!Skip(length + 4))
+            {
+                failureMessage = "File is truncated";
+                return;
+            }
+        }
+        if (colorType == 3 && paletteSize == 0)
+        {
+            failureMessage = "No palette";
+            return;
+        }
+
+        static int const samples[7] = {1, 0, 3, 1, 2, 0, 4};
+        int bitsPerPixel = samples[colorType] * depth;
+        bytesPerPixel = std::max(1, bitsPerPixel / 8);
+        scanlineSize = (size_t(width) * bitsPerPixel + 7) / 8;
+        scanline.resize(1 + scanlineSize);
+        previous.assign(scanlineSize, 0);
+        channels = colorType == 3 ? (hasTransparency ? 4 : 3) : samples[colorType] + (hasTransparency ? 1 : 0);
+    }
+
+    ~PngRowSource() override
+    {
+        if (file) fclose(file);
+    }
+
+    // True if the file starts like a PNG file
+    static bool CanRead(char const* fileName) noexcept
+    {
+        unsigned char signature[8]{};
+        FILE* f = fopen(fileName, "rb");
+        if (!f) return false;
+        bool png = fread(signature, 1, 8, f) == 8 && memcmp(signature, Signature, 8) == 0;
+        fclose(f);
+        return png;
+    }
+
+    PixData_t const* ReadRows(int rowCount, std::vector<PixData_t>& buffer) override
+    {
+        if (!file || !Valid() || rowCount <= 0 || rowCount > height - nextRow) return nullptr;
+
+        buffer.resize(size_t(rowCount) * RowSizeInBytes());
+        for (int r = 0; r < rowCount; ++r)
+        {
+            if (inflater.Read(scanline.data(), scanline.size()) != scanline.size())
+            {
+                failureMessage = inflater.Failed() ? inflater.FailureReason() : "File is truncated";
+                return nullptr;
+            }
+            if (!Unfilter())
+            {
+                failureMessage = "Bad PNG filter";
+                return nullptr;
+            }
+            Expand(buffer.data() + size_t(r) * RowSizeInBytes());
+        }
+        nextRow += rowCount;
+        return buffer.data();
+    }
+
+private:
+    static constexpr unsigned char Signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    static constexpr uint32_t MaxDimension = 1 << 24; // As stb_image allows
+
+    static constexpr uint32_t ChunkType(char const (&name)[5]) noexcept
+    {
+        return uint32_t(uint8_t(name[0])) << 24 | uint32_t(uint8_t(name[1])) << 16
+             | uint32_t(uint8_t(name[2])) << 8 | uint32_t(uint8_t(name[3]));
+    }
+
+    static uint32_t Get32(unsigned char const* p) noexcept
+    {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+    }
+
+    static uint16_t Get16(unsigned char const* p) noexcept
+    {
+        return uint16_t(p[0] << 8 | p[1]);
+    }
+
+    bool ReadChunkHeader(uint32_t& length, uint32_t& type)
+    {
+        unsigned char header[8];
+        if (fread(header, 1, 8, file) != 8) return false;
+        length = Get32(header);
+        type = Get32(header + 4);
+        return length < (1u << 31);
+    }
+
+    bool Skip(uint32_t bytes)
+    {
+        return fseek(file, long(bytes), SEEK_CUR) == 0;
+    }
+
+    bool ValidDepth() const noexcept
+    {
+        switch (colorType)
+        {
+        case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+        case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+        case 2:
+        case 4:
+        case 6: return depth == 8 || depth == 16;
+        default: return false;
+        }
+    }
+
+    // Gray of fewer than 8 bits is scaled up to fill 8
+    int GrayScale() const noexcept
+    {
+        return colorType != 0 ? 1 : depth == 1 ? 0xFF : depth == 2 ? 0x55 : depth == 4 ? 0x11 : 1;
+    }
+
+    bool ReadTransparency(unsigned char const* data, uint32_t length, int paletteSize)
+    {
+        if (colorType == 3)
+        {
+            if (paletteSize == 0 || length > uint32_t(paletteSize)) return false;
+            for (uint32_t i = 0; i < length; ++i)
+            {
+                palette[i][3] = data[i];
+            }
+        }
+        else
+        {
+            int count = colorType == 0 ? 1 : colorType == 2 ? 3 : 0;
+            if (count == 0 || length != uint32_t(2 * count)) return false;
+            for (int k = 0; k < count; ++k)
+            {
+                uint16_t value = Get16(data + 2 * k);
+                transparent[k] = depth == 16 ? value : uint16_t(uint8_t((value & 255) * GrayScale()));
+            }
+        }
+        hasTransparency = true;
+        return true;
+    }
+
+    // The image data of every IDAT chunk in turn, then nothing
+    size_t FillData(unsigned char* data, size_t size)
+    {
+        while (!dataEnded && chunkLeft == 0)
+        {
+            uint32_t length;
+            uint32_t type;
+            if (!Skip(4) || !ReadChunkHeader(length, type) || type != ChunkType("IDAT"))
+            {
+                dataEnded = true;
+                break;
+            }
+            chunkLeft = length;
+        }
+        if (dataEnded) return 0;
+
+        size_t n = fread(data, 1, std::min<size_t>(size, chunkLeft), file);
+        if (n == 0) dataEnded = true;
+        chunkLeft -= uint32_t(n);
+        return n;
+    }
+
+    // Undo the filter of the current scanline, leaving its samples in "previous"
+    bool Unfilter()
+    {
+        unsigned char* row = scanline.data() + 1;
+        unsigned char const* above = previous.data();
+        size_t const n = scanlineSize;
+        size_t const bpp = size_t(bytesPerPixel);
+
+        switch (scanline[0])
+        {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = bpp; i < n; ++i) row[i] = uint8_t(row[i] + row[i - bpp]);
+            break;
+        case 2:
+            for (size_t i = 0; i < n; ++i) row[i] = uint8_t(row[i] + above[i]);
+            break;
+        case 3:
+            for (size_t i = 0; i < n; ++i)
+            {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                row[i] = uint8_t(row[i] + ((left + above[i]) >> 1));
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < n; ++i)
+            {
+                int a = i >= bpp ? row[i - bpp] : 0;
+                int b = above[i];
+                int c = i >= bpp ? above[i - bpp] : 0;
+                int p = a + b - c;
+                int pa = abs(p - a);
+                int pb = abs(p - b);
+                int pc = abs(p - c);
+                row[i] = uint8_t(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+            }
+            break;
+        default:
+            return false;
+        }
+
+        memcpy(previous.data(), row, n);
+        return true;
+    }
+
+    // Convert the unfiltered samples of the current row to the row's pixels
+    void Expand(PixData_t* out) const
+    {
+        unsigned char const* row = previous.data();
+        int const samples = colorType == 3 ? 1 : channels - (hasTransparency ? 1 : 0);
+
+        for (int x = 0; x < width; ++x)
+        {
+            uint16_t values[4];
+            for (int k = 0; k < samples; ++k)
+            {
+                if (depth == 16)
+                {
+                    values[k] = Get16(row + 2 * (size_t(x) * samples + k));
+                }
+                else if (depth == 8)
+                {
+                    values[k] = row[size_t(x) * samples + k];
+                }
+                else
+                {
+                    size_t bit = size_t(x) * size_t(depth);
+                    int shift = 8 - depth - int(bit & 7);
+                    values[k] = uint16_t(((row[bit >> 3] >> shift) & ((1 << depth) - 1)) * GrayScale());
+                }
+            }
+
+            if (colorType == 3)
+            {
+                memcpy(out, palette[values[0]], size_t(channels));
+                out += channels;
+                continue;
+            }
+
+            bool clear = hasTransparency;
+            for (int k = 0; k < samples; ++k)
+            {
+                clear = clear && values[k] == transparent[k];
+                *out++ = PixData_t(depth == 16 ? values[k] >> 8 : values[k]);
+            }
+            if (hasTransparency) *out++ = clear ? 0 : 255;
+        }
+    }
+};
+
+// Open an image file for reading by rows.  Binary PNM and PNG files are streamed, so
+// only the rows being converted are in memory.  Other formats, and the PNG files
+// PngRowSource can't read, are decoded whole by stb_image.
+
+inline std::unique_ptr<RasterRowSource> OpenRowSource(std::string const& fileName)
+{
+    if (PnmRowSource::CanRead(fileName.c_str()))
+    {
+        auto pnm = std::make_unique<PnmRowSource>(fileName.c_str());
+        if (pnm->Valid()) return pnm;
+    }
+    if (PngRowSource::CanRead(fileName.c_str()))
+    {
+        auto png = std::make_unique<PngRowSource>(fileName.c_str());
+        if (png->Valid()) return png;
+    }
+
+    return std::make_unique<ImageRowSource>(RasterImage(fileName));
+}
@@ -0,0 +1,89 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Where each row's shapes are in an SVG file written a row at a time, in the streamable
+// modes, so the text of unchanged rows can be copied into a new version of the file.
+// Such a file is a header, then one <polygon> per line, with the polygons of each row
+// together and the rows in order, then a trailer.  A polygon's row is found from the y
+// of its first point, so rowY must hold each row's y exactly as it is formatted.
+
+class SvgRowIndex
+{
+    std::string_view text;
+    std::vector<size_t> rowStart;  // Offset in text of each row's first line, and the end
+
+public:
+    // Index the rows of "svg", or return false if it isn't what the streamable modes
+    // would write with this header, trailer and row count
+
+    bool Build(std::string_view svg, std::string_view header, std::string_view trailer,
+        std::vector<std::string_view> const& rowY)
+    {
+        static constexpr std::string_view linePrefix = "\t<polygon points=\"";
+
+        if (svg.size() < header.size() + trailer.size()
+            || svg.substr(0, header.size()) != header
+            || svg.substr(svg.size() - trailer.size()) != trailer)
+        {
+            return false;
+        }
+
+        std::unordered_map<std::string_view, int> rowOfY;
+        for (int r = 0; r < int(rowY.size()); ++r)
+        {
+            if (!rowOfY.emplace(rowY[r], r).second) return false;  // Rows too close to tell apart
+        }
+
+        text = svg;
+        int const rowCount = int(rowY.size());
+        rowStart.assign(rowCount + 1, 0);
+
+        size_t const end = svg.size() - trailer.size();
+        size_t pos = header.size();
+        int row = 0;
+        rowStart[0] = pos;
+        while (pos < end)
+        {
+            size_t lineEnd = svg.find('\n', pos);
+            if (lineEnd == std::string_view::npos || lineEnd >= end) return false;
+            std::string_view line = svg.substr(pos, lineEnd - pos);
+            if (line.substr(0, linePrefix.size()) != linePrefix) return false;
+
+            size_t comma = line.find(',', linePrefix.size());
+            size_t space = line.find(' ', comma);
+            if (comma == std::string_view::npos || space == std::string_view::npos) return false;
+            auto found = rowOfY.find(line.substr(comma + 1, space - comma - 1));
+            if (found == rowOfY.end() || found->second < row) return false;
+
+            // Rows before this line's, back to the last one seen, start here
+            while (row < found->second)
+            {
+                rowStart[++row] = pos;
+            }
+            pos = lineEnd + 1;
+        }
+        while (row < rowCount)
+        {
+            rowStart[++row] = end;
+        }
+        return true;
+    }
+
+    // Text of a row's shapes, including their line ends
+    std::string_view Row(int r) const noexcept
+    {
+        return text.substr(rowStart[r], rowStart[r + 1] - rowStart[r]);
+    }
+};
@@ -0,0 +1,110 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include "simple_svg_1.0.0.hpp"
+
+#include "OutputSink.h"
+#include "ConversionStats.h"
+
+#include <string>
+
+// Incremental replacement for svg::Document.  Instead of collecting every shape's
+// string until save() is called, the header is written by Begin(), each shape is
+// serialized straight to the output sink as it is added, and End() writes the
+// closing tag.  Memory use is independent of the number of shapes.  Time spent writing
+// and closing the sink is added to the write phase of "stats", if given.
+
+class SvgWriter
+{
+    OutputSink& out;
+    svg::Layout layout;
+    ConversionStats* stats;
+    size_t bytesWritten{};
+    bool ok{true};
+
+public:
+    SvgWriter(OutputSink& out_, svg::Layout const& layout_, ConversionStats* stats_ = nullptr)
+        : out(out_)
+        , layout(layout_)
+        , stats(stats_)
+    {
+    }
+
+    SvgWriter(SvgWriter const& other) = delete;
+    SvgWriter& operator=(SvgWriter const& other) = delete;
+
+    svg::Layout const& GetLayout() const noexcept { return layout; }
+
+    // Total bytes passed to the sink so far
+    size_t BytesWritten() const noexcept { return bytesWritten; }
+
+    // False if any write to the sink has failed
+    bool Good() const noexcept { return ok; }
+
+    // XML prolog and opening <svg> tag, identical to svg::Document's, as written by Begin()
+
+    static std::string Header(svg::Layout const& layout)
+    {
+        using svg::attribute;
+
+        std::string header;
+        header += "<?xml ";
+        header += attribute("version", "1.0");
+        header += attribute("standalone", "no");
+        header += "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" ";
+        header += "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg ";
+        header += attribute("width", layout.dimensions.width, "px");
+        header += attribute("height", layout.dimensions.height, "px");
+        header += attribute("xmlns", "http://www.w3.org/2000/svg");
+        header += attribute("version", "1.1");
+        header += ">\n";
+        return header;
+    }
+
+    // Closing tag, as written by End()
+    static std::string Trailer() { return svg::elemEnd("svg"); }
+
+    bool Begin()
+    {
+        return Write(Header(layout));
+    }
+
+    // Write pre-serialized body text
+
+    bool Write(char const* data, size_t size)
+    {
+        if (!ok) return false;
+        PhaseTimer timer(stats, Phase::write);
+        ok = out.Write(data, size);
+        bytesWritten += size;
+        return ok;
+    }
+
+    bool Write(std::string const& str) { return Write(str.data(), str.size()); }
+
+    // Serialize a shape using simple-svg, and write it immediately
+
+    SvgWriter& operator<<(svg::Shape const& shape)
+    {
+        Write(shape.toString(layout));
+        return *this;
+    }
+
+    // Write the closing tag and close the sink
+
+    bool End()
+    {
+        Write(Trailer());
+        PhaseTimer timer(stats, Phase::write);
+        bool closed = out.Close();
+        ok = ok && closed;
+        return ok;
+    }
+};
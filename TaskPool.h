@@ -0,0 +1,140 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Run task(i) for every i in [0, taskCount) on a pool of threads, using work stealing.
+// Tasks are dealt round-robin to per-thread queues in index order, so when tasks are
+// sorted by decreasing cost, every thread starts on the biggest ones.  Each thread
+// takes work from the front of its own queue, and once that is empty, steals from the
+// back of the others', where the cheapest remaining tasks are, so threads that drew
+// short tasks pick up the slack of those stuck on long ones.
+//
+//   task(size_t i) -> void, called concurrently for different i
+
+template <typename Task>
+void ForEachTaskStealing(size_t taskCount, int threadCount, Task&& task)
+{
+    int workerCount = int(std::min<size_t>(std::max(1, threadCount), taskCount));
+    if (workerCount <= 1)
+    {
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<Queue> queues(workerCount);
+    for (size_t i = 0; i < taskCount; ++i)
+    {
+        queues[i % workerCount].tasks.push_back(i);
+    }
+
+    // Queues only shrink, so once a worker finds them all empty, it is done
+    auto next = [&](int self, size_t& i)
+    {
+        for (int k = 0; k < workerCount; ++k)
+        {
+            Queue& q = queues[(self + k) % workerCount];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+
+            if (k == 0)
+            {
+                i = q.tasks.front();
+                q.tasks.pop_front();
+            }
+            else
+            {
+                i = q.tasks.back();
+                q.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+
+    auto worker = [&](int self)
+    {
+        size_t i;
+        while (next(self, i))
+        {
+            task(i);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount - 1);
+    for (int w = 1; w < workerCount; ++w)
+    {
+        workers.emplace_back(worker, w);
+    }
+    worker(0);
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+// Queue of work items handed from producers to long-lived worker threads.  Pop() waits
+// for an item, and returns false once the queue is closed and empty, so workers can
+// loop until there is no more work.
+
+template <typename T>
+class WorkQueue
+{
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<T> items;
+    bool closed = false;
+
+public:
+    void Push(T item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(std::move(item));
+        }
+        ready.notify_one();
+    }
+
+    // No more items will be pushed
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+};
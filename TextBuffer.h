@@ -0,0 +1,76 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <memory>
+#include <string>
+
+// Growable char buffer for serializing output text.  Formatters reserve a worst-case
+// amount of space, write directly into it, and commit the end pointer.  Clear() keeps
+// the allocation, so a buffer reused across rows or elements stops allocating once it
+// has grown to its working size.
+
+class TextBuffer
+{
+    std::unique_ptr<char[]> buf;
+    size_t capacity{};
+    size_t length{};
+
+public:
+    TextBuffer() = default;
+    explicit TextBuffer(size_t initialCapacity) { Grow(initialCapacity); }
+
+    TextBuffer(TextBuffer&& other) noexcept = default;
+    TextBuffer& operator=(TextBuffer&& other) noexcept = default;
+
+    char const* Data() const noexcept { return buf.get(); }
+    size_t Size() const noexcept { return length; }
+    size_t Capacity() const noexcept { return capacity; }
+    bool Empty() const noexcept { return length == 0; }
+
+    void Clear() noexcept { length = 0; }
+
+    // Ensure room for at least n more chars, and return a pointer to the end of the text
+
+    char* Reserve(size_t n)
+    {
+        if (capacity - length < n) Grow(length + n);
+        return buf.get() + length;
+    }
+
+    // Mark text up to "end" as written.  "end" must be within the last reserved space.
+
+    void Commit(char* end) noexcept
+    {
+        length = size_t(end - buf.get());
+    }
+
+    void Append(char const* data, size_t n)
+    {
+        char* p = Reserve(n);
+        memcpy(p, data, n);
+        length += n;
+    }
+
+    void Append(std::string const& str) { Append(str.data(), str.size()); }
+
+private:
+    void Grow(size_t minCapacity)
+    {
+        size_t newCapacity = capacity < 4096 ? 4096 : capacity * 2;
+        if (newCapacity < minCapacity) newCapacity = minCapacity;
+
+        std::unique_ptr<char[]> newBuf(new char[newCapacity]);
+        if (length) memcpy(newBuf.get(), buf.get(), length);
+        buf.swap(newBuf);
+        capacity = newCapacity;
+    }
+};
@@ -6,14 +6,35 @@
 * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 */
 
-#include "simple_svg_1.0.0.hpp"
-
-#include "RasterImage.h"
+#include "Convert.h"
+#include "GzipOutputSink.h"
+#include "BandPipeline.h"
+#include "IndexedImage.h"
+#include "BatchInputs.h"
+#include "TaskPool.h"
+#include "ContentHash.h"
+#include "OutputCache.h"
+#include "ImageDiff.h"
+#include "SvgSplice.h"
+#include "Json.h"
 #include "CommandLine.h"
 
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <filesystem>
 #include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 using namespace std::literals;
 using namespace std::chrono;
@@ -22,16 +43,54 @@ auto& now = steady_clock::now;
 
 struct Options : CommandLine::Parser
 {
-    Value<string> inputFile    {is, "-i", "--inputFile",         "Name of input file, a raster image (the \"-i\" is optional)."};
-    Value<string> outputFile   {is, "-o", "--outputFile",        "Name of output file, an SVG file (default is input file changed to .svg)."};
+    Value<string> inputFile    {is, "-i", "--inputFile",         "Name of input file, a raster image (the \"-i\" is optional).  Binary PNM and non-interlaced PNG files are read by rows when the mode allows it; other formats are loaded whole."};
+    Value<string> outputFile   {is, "-o", "--outputFile",        "Name of output file, an SVG file (default is input file changed to .svg), or \"-\" for stdout.  A name ending in .svgz means compressed output.  With --batch, a directory for all output files."};
     Value<double> scale        {is, "-s", "--scale",       10.0, "Scale factor. Default is 1."};
     Value<double> strokeWidth  {is, "-w", "--strokeWidth", 0.01, "Width of strokes to use for all paths."};
+    Value<int>    threads      {is, "-t", "--threads",     0,    "Number of worker threads.  Default (0) is one per hardware thread."};
+    Enum<MergeMode> merge      {is, "-m", "--merge",  MergeMode::none, "How to combine same-colored pixels into shapes."};
+    Enum<GroupMode> group      {is, "-g", "--group",  GroupMode::none, "How to share fill and stroke attributes among shapes."};
+    Value<int>    maxColors    {is, "-c", "--max-colors",  0,    "Reduce the image to at most this many colors (up to 65536) before converting.  Default (0) keeps every color."};
+    Value<string> background   {is, "-k", "--background",  "none", "\"auto\" to draw the most frequent color as one background rectangle, instead of as shapes, if every other pixel is opaque, or \"none\"."};
+    ValueList<string> batch    {is, "-b", "--batch",             "Convert many input files at once: any mix of files, directories (converting all images in them, recursively), and wildcard patterns like sprites/*.png.  Files are converted concurrently, one per thread."};
+    Option        svgz         {is, "-z", "--svgz",              "Write gzip-compressed SVG, with the .svgz extension if the output name is derived from the input."};
+    Value<int>    ioBuffer     {is, nullptr, "--io-buffer",  4,  "Size of the output write buffer, in MB.  Bigger buffers make fewer write calls, which helps on network file systems."};
+    Option        directIO     {is, nullptr, "--direct-io",      "Write output files bypassing the OS page cache (Linux only)."};
+    Option        stats        {is, nullptr, "--stats",          "Print the time spent in each phase of conversion, and counts of elements, bytes, allocations and colors."};
+    Value<string> statsJson    {is, nullptr, "--stats-json",     "Write the statistics of --stats to this file, as JSON."};
+    Value<double> progress     {is, "-p", "--progress",    2.0,  "Seconds between progress reports, starting once a conversion has taken that long, or 0 for none."};
+    Value<string> cache        {is, nullptr, "--cache",          "Directory of cached outputs.  An image whose pixels and options match an earlier conversion's is copied from the cache instead of converted again, and new outputs are added."};
+    Value<string> diffFrom     {is, nullptr, "--diff-from",      "Previous version of the input image.  Only rows that differ from it are converted, and the rest are copied from the previous output (see --diff-svg), which must be from the same options.  With --tile, only tiles that differ are converted."};
+    Value<string> diffSvg      {is, nullptr, "--diff-svg",       "SVG file converted from the --diff-from image, if not the output file itself."};
+    Option        frames       {is, nullptr, "--frames",         "Convert every frame of an animated GIF, each to its own SVG file named after the output file with \"-frame\" added, and listed with its delay in a JSON manifest named after the output file with .frames.json.  Identical frames, and with --tile identical tiles, are converted once.  Frames share one palette, and with --group css one style sheet."};
+    Value<string> tile         {is, nullptr, "--tile",           "Split the image into tiles of WxH pixels, converted in parallel, each to its own SVG file named after the output file with \"-row-col\" added, and listed in a JSON manifest named after the output file with .tiles.json."};
+    Option        daemon       {is, nullptr, "--daemon",         "Run as a server, converting jobs read from stdin as JSON objects, one per line, like {\"id\": 1, \"input\": \"sprite.png\"}, and writing a JSON line per job to stdout, followed by the SVG unless the job names an \"output\" file.  Jobs run concurrently, one per thread, with the other options applying to all."};
+    Option        dryRun       {is, nullptr, "--dry-run",        "Only print how many elements and bytes the SVG will have, without writing it.  With --merge none or runs and nothing grouped, this is counted in a quick pass over the pixels; otherwise the image is converted without output, which takes about as long as converting."};
     Option        help         {is, "-h", "--help",              "Show this help text."};
 
+    // Parsed from --tile, or 0 without it
+    int tileWidth = 0;
+    int tileHeight = 0;
+
+    // The options that go into every conversion
+    ConvertOptions convert;
+
     bool Validate() override
     {
+        if (daemon)
+        {
+            // Jobs name their own inputs and outputs
+            if (batch.specified || inputFile.specified || outputFile.specified || otherArgs.size() != 0) return false;
+            if (diffFrom.specified) return false;
+        }
+        else if (batch.specified)
+        {
+            // Inputs all come from the batch list, and outputs are derived from them
+            if (inputFile.specified || otherArgs.size() != 0) return false;
+            if (outputFile.value == "-") return false;
+        }
         // Allow inputFile to be passed as the first positional arg
-        if (!inputFile.specified && otherArgs.size() == 1)
+        else if (!inputFile.specified && otherArgs.size() == 1)
         {
             inputFile.value = otherArgs[0];
             inputFile.specified = true;
@@ -39,117 +98,1197 @@ struct Options : CommandLine::Parser
         else if (!inputFile.specified)  return false;  // Input file is required
         else if (otherArgs.size() != 0) return false;  // No positional args expected aside from implicit -i
 
-        if (!outputFile.specified)
+        if (!outputFile.specified && !batch.specified && !daemon)
         {
             // Derive output name from input name
             std::filesystem::path path(inputFile.value);
-            path.replace_extension("svg");
+            path.replace_extension(svgz ? "svgz" : "svg");
             outputFile.value = path.string();
         }
 
         if (scale <= 0.0) return false;
         if (strokeWidth < 0.0) return false;  // 0 is allowed
+        if (threads < 0) return false;        // 0 means use all hardware threads
+        if (ioBuffer < 1 || ioBuffer > 1024) return false;
+        if (progress < 0.0) return false;
+        if (tile.specified)
+        {
+            char extra;
+            if (sscanf(tile.value.c_str(), "%dx%d%c", &tileWidth, &tileHeight, &extra) != 2) return false;
+            if (tileWidth <= 0 || tileHeight <= 0) return false;
+            if (outputFile.value == "-") return false;
+        }
+        if (cache.specified && outputFile.value == "-") return false;
+        if (diffFrom.specified && (batch.specified || outputFile.value == "-")) return false;
+        if (diffSvg.specified && !diffFrom.specified) return false;
+        if (frames && (diffFrom.specified || outputFile.value == "-")) return false;
+        if (dryRun && (batch.specified || daemon || tile.specified || frames || diffFrom.specified)) return false;
+        if (maxColors < 0 || size_t(maxColors.value) > IndexedImage::MaxColors) return false;
+        if (background.value != "none" && background.value != "auto") return false;
+        if (threads == 0) threads.value = HardwareThreadCount();
 
+        convert.scale = scale;
+        convert.strokeWidth = strokeWidth;
+        convert.merge = merge;
+        convert.group = group;
+        convert.maxColors = maxColors;
+        convert.autoBackground = background.value == "auto";
+        convert.threads = threads;
         return true;
     }
 } g_opts;
 
-svg::Document RasterPixelsToSvg(RasterImage const& img, std::string const& outputFile)
+// Convert a new version of an image in a streamable mode, copying the polygons of the
+// rows that haven't changed from the SVG of the old version, and converting only the
+// rows that have, a band at a time as in StreamPixelsToSvg.
+
+bool SpliceRowsToSvg(RasterImage const& img, std::vector<uint8_t> const& changed, SvgRowIndex const& previous,
+    SvgWriter& doc, ConvertOptions const& opts, ConversionStats* stats, ProgressReporter* progress)
 {
-    using namespace svg;
+    if (!doc.Begin()) return false;
 
-    Dimensions dimensions(
-        g_opts.scale * img.Width(),
-        g_opts.scale * img.Height());
-    Document doc(outputFile, Layout(dimensions, Layout::TopLeft, g_opts.scale));
+    PixelEmitter emitter(doc.GetLayout(), opts.strokeWidth);
+    int const width = img.Width();
+    int bandRows = RowsPerBand(width);
+    if (progress) progress->Stage("splicing", uint64_t(img.Height()), "rows");
 
-    auto startTime = now();
-    std::chrono::nanoseconds estTotalDur, totalDur;
-    bool slow = false;
+    // Only scratch space, since the pixels are all in memory
+    struct BandScratch
+    {
+        std::vector<RasterImage::RGBA> colors;
+    };
 
-    for (int r = 0; r < img.Height(); ++r)
+    auto readBand = [](int, int, int, BandScratch&) { return true; };
+
+    auto convertBandOf = [&](auto channelCount)
     {
-        for (int c = 0; c < img.Width(); ++c)
+        constexpr int Channels = decltype(channelCount)::value;
+
+        return [&](int, int rowBegin, int rowEnd, BandScratch& scratch, TextBuffer& text)
         {
-            auto pixelColor = img.GetPixelRGBA(r, c);
+            PhaseTimer phases(stats, Phase::serialize);
+            uint64_t elements = 0;
+            auto& colors = scratch.colors;
+            colors.resize(width);
+
+            for (int r = rowBegin; r < rowEnd; ++r)
+            {
+                if (!changed[r])
+                {
+                    std::string_view row = previous.Row(r);
+                    text.Append(row.data(), row.size());
+                    if (stats) elements += uint64_t(std::count(row.begin(), row.end(), '\n'));
+                    continue;
+                }
+
+                phases.Switch(Phase::convert);
+                ConvertPixelsToRGBA(img.Pixel(r, 0), Channels, reinterpret_cast<RasterImage::PixData_t*>(colors.data()), size_t(width));
+                phases.Switch(Phase::serialize);
+                elements += EmitStreamedRow<Channels>(emitter, opts.merge, img.Pixel(r, 0), colors.data(), r, width, text);
+            }
 
-            // simple-svg library doesn't support alpha, just fully-transparent.
-            // Force any pixels that aren't fully opaque to be transparent.
-            Color color = pixelColor.a < 0xFF
-                ? Color::Transparent
-                : Color(pixelColor.r, pixelColor.g, pixelColor.b);
+            if (stats) stats->elements += elements;
+        };
+    };
 
-            Polygon pixel(Fill(color), Stroke(g_opts.strokeWidth, Color::Black));
-            pixel
-                << Point(c,     r    )
-                << Point(c + 1, r    )
-                << Point(c + 1, r + 1)
-                << Point(c,     r + 1);
-            doc << pixel;
+    auto writeBand = [&](int band, TextBuffer const& text)
+    {
+        if (!doc.Write(text.Data(), text.Size())) return false;
+        if (progress)
+        {
+            progress->Advance(uint64_t(std::min(bandRows, img.Height() - band * bandRows)));
+            progress->SetBytesWritten(doc.BytesWritten());
         }
+        return true;
+    };
 
-        if (r == 0)
+    bool ok = WithChannelCount(img.ChannelCount(), [&](auto channelCount)
+    {
+        return ForEachBandOrdered<BandScratch>(img.Height(), bandRows, opts.threads, readBand, convertBandOf(channelCount), writeBand);
+    });
+    if (!ok) return false;
+
+    if (progress) progress->Stage("closing output");
+    return doc.End();
+}
+
+bool IsSvgzFile(std::string const& fileName)
+{
+    std::string ext = std::filesystem::path(fileName).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(tolower((unsigned char)c)); });
+    return ext == ".svgz";
+}
+
+bool IsCompressedOutput(std::string const& fileName)
+{
+    return g_opts.svgz || IsSvgzFile(fileName);
+}
+
+// The arena the shapes of images converted on this thread are allocated from, which
+// keeps its memory from one image to the next.  Conversions release it when done.
+
+static ConversionArena& ThreadArena()
+{
+    static thread_local ConversionArena arena;
+    return arena;
+}
+
+// Images of fewer pixels than this aren't counted before they're streamed, to set their
+// file's space aside
+constexpr uint64_t PreallocatePixels = 1 << 20;
+
+// Convert an image to an SVG file.  The image is read from "rows", which in modes that
+// aren't streamable must be an ImageRowSource of "img".
+
+bool WriteSvgFile(std::string const& outputFile, RasterRowSource& rows, RasterImage const& img, ConvertOptions const& opts,
+    std::ostream& log, ConversionStats* stats, ProgressReporter* progress, SharedStyles const* styles = nullptr)
+{
+    FileOutputSink file(outputFile, size_t(g_opts.ioBuffer.value) << 20, g_opts.directIO);
+    if (!file.Valid())
+    {
+        log << "Cannot open output file!\n";
+        return false;
+    }
+
+    std::unique_ptr<GzipOutputSink> gzip;
+    if (IsCompressedOutput(outputFile)) gzip = std::make_unique<GzipOutputSink>(file, opts.threads);
+    OutputSink& sink = gzip ? static_cast<OutputSink&>(*gzip) : file;
+
+    // In streamable modes, a first pass that counts runs gives the output's exact size
+    // for far less than converting costs, as long as the image can be read again cheaply,
+    // so the file's space can be set aside, to be written contiguously, and the band
+    // buffers can start out big enough for any band.  Small images are written in a few
+    // writes anyway.  In the other modes, only converting tells, so the file grows as
+    // it's written.
+    OutputEstimate estimate;
+    bool estimated = false;
+    if (IsStreamable(opts) && uint64_t(rows.Width()) * rows.Height() >= PreallocatePixels)
+    {
+        PhaseTimer counting(stats, Phase::convert);
+        std::unique_ptr<RasterRowSource> counted = rows.Reopen();
+        estimated = counted && EstimateOutput(*counted, opts, estimate, progress);
+        if (estimated && !gzip) file.Preallocate(estimate.bytes);
+    }
+
+    SvgWriter doc(sink, LayoutFor(opts, rows.Width(), rows.Height()), stats);
+    bool ok = IsStreamable(opts)
+        ? StreamPixelsToSvg(rows, doc, opts, stats, progress, estimated ? &estimate : nullptr)
+        : RasterPixelsToSvg(img, doc, opts, stats, progress, styles, &ThreadArena());
+    ThreadArena().Release();
+    if (!ok && !rows.Valid()) log << "Error reading input image: " << rows.FailureReason() << "\n";
+
+    if (stats)
+    {
+        stats->svgBytes += doc.BytesWritten();
+        stats->fileBytes += file.BytesWritten();
+    }
+    return ok;
+}
+
+// Bumped whenever the output for the same pixels and options changes, so older cache
+// entries are no longer found
+constexpr int CacheVersion = 2;
+
+// Key of an image's output in the cache: a hash of its pixels and of every option that
+// affects the output.  Threads, buffer sizes and the like don't.  With --group css,
+// shared styles change the class numbers and the link to the style sheet.
+
+uint64_t CacheKey(RasterImage const& img, ConvertOptions const& opts, SharedStyles const* styles)
+{
+    std::ostringstream options;
+    options << std::setprecision(17)
+        << "raster2vector " << CacheVersion
+        << " image " << img.Width() << "x" << img.Height() << "x" << img.ChannelCount()
+        << " scale " << opts.scale
+        << " stroke " << opts.strokeWidth
+        << " merge " << EnumNameMapFor(MergeMode{}).Name(opts.merge)
+        << " group " << EnumNameMapFor(GroupMode{}).Name(opts.group)
+        << " colors " << opts.maxColors
+        << " background " << (opts.autoBackground ? "auto" : "none");
+    if (styles && opts.group == GroupMode::css)
+    {
+        options << " styles " << styles->styleSheet;
+        for (uint32_t c = 0; c < styles->palette.Size(); ++c)
+        {
+            options << " " << Palette::Key(styles->palette.Color(c));
+        }
+    }
+
+    return ContentHash(img.Pixel(0, 0), img.SizeInBytes(), ContentHash(options.str()));
+}
+
+// As WriteSvgFile, but with --cache, copying the output from the cache instead if it's
+// there, and adding it to the cache after converting if not.  Only whole images can be
+// looked up, since the key is a hash of all their pixels.
+
+bool WriteSvgFileCached(std::string const& outputFile, RasterRowSource& rows, RasterImage const& img, ConvertOptions const& opts,
+    std::ostream& log, ConversionStats* stats, ProgressReporter* progress, SharedStyles const* styles = nullptr)
+{
+    if (!g_opts.cache.specified) return WriteSvgFile(outputFile, rows, img, opts, log, stats, progress, styles);
+
+    if (progress) progress->Stage("hashing");
+    OutputCache cache(g_opts.cache.value);
+    uint64_t key = CacheKey(img, opts, styles);
+    std::string ext = IsCompressedOutput(outputFile) ? ".svgz" : ".svg";
+
+    if (cache.Fetch(key, ext, outputFile))
+    {
+        log << "Copied output from cache.\n";
+        if (stats)
+        {
+            ++stats->cacheHits;
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(outputFile, ec);
+            if (!ec) stats->fileBytes += size;
+        }
+        return true;
+    }
+
+    if (stats) ++stats->cacheMisses;
+    if (!WriteSvgFile(outputFile, rows, img, opts, log, stats, progress, styles)) return false;
+
+    // Failing to cache the output doesn't fail the conversion
+    if (!cache.Store(key, ext, outputFile)) log << "Cannot add output to cache " << g_opts.cache.value << "\n";
+    return true;
+}
+
+// Whether converting row r of the image gives the same text as "previous" has for it,
+// as it will if the previous SVG was converted with the same options as these
+
+bool RowConvertsTo(RasterImage const& img, int r, PixelEmitter const& emitter, MergeMode merge, std::string_view previous)
+{
+    std::vector<RasterImage::RGBA> colors(img.Width());
+    TextBuffer text;
+    WithChannelCount(img.ChannelCount(), [&](auto channelCount)
+    {
+        constexpr int Channels = decltype(channelCount)::value;
+        ConvertPixelsToRGBA(img.Pixel(r, 0), Channels, reinterpret_cast<RasterImage::PixData_t*>(colors.data()), colors.size());
+        EmitStreamedRow<Channels>(emitter, merge, img.Pixel(r, 0), colors.data(), r, img.Width(), text);
+        return true;
+    });
+    return std::string_view(text.Data(), text.Size()) == previous;
+}
+
+// With --diff-from, convert only the rows of the image that differ from the previous
+// version, copying the rest from the previous version's SVG (--diff-svg, or the output
+// file itself), which must have been converted with the same options.  The new file is
+// written beside the output and renamed over it, since the old one may be the output.
+// Converts the whole image, as WriteSvgFileCached, when rows can't be reused.
+
+bool WriteSvgFileSpliced(std::string const& outputFile, RasterImage const& img, RasterImage const& previous,
+    ConvertOptions const& opts, std::ostream& log, ConversionStats* stats, ProgressReporter* progress)
+{
+    auto convertAll = [&](char const* reason)
+    {
+        log << "Converting the whole image, since " << reason << ".\n";
+        ImageRowSource rows(img);
+        return WriteSvgFileCached(outputFile, rows, img, opts, log, stats, progress);
+    };
+
+    if (!IsStreamable(opts)) return convertAll("rows can only be reused with --merge none or runs and nothing grouped");
+    if (IsCompressedOutput(outputFile)) return convertAll("rows can't be reused from compressed output");
+    if (!SameLayout(img, previous)) return convertAll("the previous image has a different size or format");
+
+    std::string const previousSvg = g_opts.diffSvg.specified ? g_opts.diffSvg.value : outputFile;
+    std::string const newFile = outputFile + ".new";
+    {
+        svg::Layout layout = LayoutFor(opts, img.Width(), img.Height());
+        PixelEmitter emitter(layout, opts.strokeWidth);
+
+        // Every row's y as formatted in its polygons, to tell which row each belongs to
+        std::vector<std::string> rowY(img.Height());
+        std::vector<std::string_view> rowYViews(img.Height());
+        for (int r = 0; r < img.Height(); ++r)
         {
-            auto oneRowDur = now() - startTime;
-            estTotalDur = img.Height() * oneRowDur;
+            char y[32];
+            rowY[r].assign(y, emitter.FormatY(y, r));
+            rowYViews[r] = rowY[r];
+        }
 
-            if (estTotalDur > 2s)
+        MappedFile old(previousSvg.c_str());
+        SvgRowIndex index;
+        if (!old.Valid()
+            || !index.Build(std::string_view(reinterpret_cast<char const*>(old.Data()), old.Size()),
+                            SvgWriter::Header(layout), SvgWriter::Trailer(), rowYViews))
+        {
+            return convertAll("the previous SVG isn't a row-by-row conversion of an image this size");
+        }
+
+        // Row text depends on the stroke, merge mode and so on, which the header doesn't
+        // show, so check that the first unchanged row with any polygons still converts
+        // to the same text
+        std::vector<uint8_t> changed = ChangedRows(img, previous);
+        for (int r = 0; r < img.Height(); ++r)
+        {
+            if (changed[r] || index.Row(r).empty()) continue;
+            if (!RowConvertsTo(img, r, emitter, opts.merge, index.Row(r)))
             {
-                slow = true;
-                std::cout << "Estimated path construction time: "
-                    << duration_cast<seconds>(estTotalDur).count() << " seconds\n";
+                return convertAll("the previous SVG was converted with different options");
             }
+            break;
         }
-    }
 
-    totalDur = now() - startTime;
+        size_t changedCount = size_t(std::count(changed.begin(), changed.end(), uint8_t(1)));
+        log << "Reusing " << img.Height() - changedCount << " of " << img.Height() << " rows from " << previousSvg << ".\n";
+        if (stats) stats->reusedRows += uint64_t(img.Height() - changedCount);
 
-    if (slow)
+        FileOutputSink file(newFile, size_t(g_opts.ioBuffer.value) << 20, g_opts.directIO);
+        if (!file.Valid())
+        {
+            log << "Cannot open output file!\n";
+            return false;
+        }
+
+        SvgWriter doc(file, layout, stats);
+        bool ok = SpliceRowsToSvg(img, changed, index, doc, opts, stats, progress);
+        if (stats)
+        {
+            stats->svgBytes += doc.BytesWritten();
+            stats->fileBytes += file.BytesWritten();
+        }
+        if (!ok)
+        {
+            std::error_code ec;
+            std::filesystem::remove(newFile, ec);
+            return false;
+        }
+    }
+
+    // The old file is unmapped by now, so it can be replaced on any OS
+    std::error_code ec;
+    std::filesystem::rename(newFile, outputFile, ec);
+    if (ec)
     {
-        auto percentOffFromEstimate =
-            100 * double(totalDur.count() - estTotalDur.count())
-            / totalDur.count();
-        std::cout << "Actual path construction time:    "
-            << duration_cast<seconds>(totalDur).count() << " seconds ("
-            << percentOffFromEstimate << "% difference from estimate)\n";
+        log << "Cannot replace " << outputFile << ": " << ec.message() << "\n";
+        return false;
     }
-    else
+    return true;
+}
+
+// Files written for tiles, by a hash of their pixels, so that tiles with the same pixels
+// are converted once and share a file.  Each tile is kept as where its pixels are in
+// its frame, which outlives this, so a matching hash can be checked against them.  A
+// tile is only shared once its file has been written; until then, tiles with the same
+// pixels wait for it, and if it fails, the next of them converts its own.
+
+struct ConvertedTiles
+{
+    enum class State
+    {
+        converting,
+        converted,
+        failed
+    };
+
+    struct Tile
     {
-        auto durMs = duration_cast<milliseconds>(totalDur).count();
+        RasterImage const* img;
+        int x, y, w, h;
+        std::string file;
+        State state = State::converting;
+    };
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::unordered_multimap<uint64_t, Tile> tiles;
+};
+
+// Convert "count" items of an image, such as tiles or frames, each to an SVG file of its
+// own, several at a time.  With fewer items than threads, each item gets several.
+// Items log to a log of their own, which is copied to "log" only if they fail, so the
+// logs of items converted at once don't mix.  Returns true if every item succeeded.
+//
+//   nameOf(size_t i) -> std::string, the file name of item i, for logging
+//   convertOne(size_t i, ConvertOptions const& itemOpts, std::ostream& itemLog) -> bool
+
+template <typename NameOf, typename ConvertOne>
+bool ConvertEachInParallel(size_t count, char const* kind, ConvertOptions const& opts, std::ostream& log,
+    ProgressReporter& progress, NameOf&& nameOf, ConvertOne&& convertOne)
+{
+    ConvertOptions itemOpts = opts;
+    itemOpts.threads = std::max(1, opts.threads / int(std::clamp<size_t>(count, 1, INT_MAX)));
+    std::mutex logMutex;
+    std::atomic<size_t> failures{0};
+
+    ForEachTaskStealing(count, opts.threads, [&](size_t i)
+    {
+        std::ostringstream itemLog;
+        bool ok = convertOne(i, itemOpts, itemLog);
+        progress.Advance(1);
+
+        if (!ok)
+        {
+            ++failures;
+            std::lock_guard<std::mutex> lock(logMutex);
+            log << kind << " " << nameOf(i) << " failed!\n" << itemLog.str();
+        }
+    });
+    return failures == 0;
+}
+
+// Write the JSON manifest of the files an image was converted to.  The manifest goes
+// next to the files, and names them relative to itself.  After the image's size and
+// scale, "fields" writes any other fields, each starting with a comma, and then
+// "entry" writes the fields of each of the "count" objects in the list "listName".
+//
+//   fields(std::ostream& manifest) -> void
+//   entry(std::ostream& manifest, size_t i) -> void
 
-        std::cout << "Path construction time: " << durMs << " ms\n";
+template <typename Fields, typename Entry>
+bool WriteManifest(std::filesystem::path const& manifestName, char const* kind, int width, int height, double scale,
+    std::ostream& log, Fields&& fields, char const* listName, size_t count, Entry&& entry)
+{
+    std::ofstream manifest(manifestName);
+    manifest << "{\n  \"width\": " << width
+             << ",\n  \"height\": " << height
+             << ",\n  \"scale\": " << scale;
+    fields(manifest);
+    manifest << ",\n  \"" << listName << "\": [";
+    for (size_t i = 0; i < count; ++i)
+    {
+        manifest << (i ? "," : "") << "\n    {";
+        entry(manifest, i);
+        manifest << "}";
     }
+    manifest << "\n  ]\n}\n";
 
-    return doc;
+    if (!manifest.flush())
+    {
+        log << "Cannot write " << kind << " manifest " << manifestName.string() << "!\n";
+        return false;
+    }
+    return true;
 }
 
-int main(int argc, const char** argv)
+// Split an image into tiles of the --tile size, and convert each to an SVG file of its
+// own, several tiles at a time.  Tile files are named after the output file, with the
+// row and column of the tile added, and are listed, with their positions in the image,
+// in a JSON manifest also named after the output file.  Each tile is drawn from (0, 0),
+// so it stands on its own, and goes at its x and y in the image, times the scale.  With
+// --cache, each tile is looked up by itself, so only tiles that changed are converted.
+// Given the previous version of the image, tiles whose pixels are the same in it are
+// skipped, if their files are there.  Given the tiles converted so far, tiles with the
+// same pixels as one of them are skipped too, and the manifest names its file.
+
+bool ConvertTiles(RasterImage const& img, RasterImage const* previous, std::string const& outputFile, ConvertOptions const& opts,
+    std::ostream& log, ConversionStats* stats, ProgressReporter& progress,
+    SharedStyles const* styles = nullptr, ConvertedTiles* converted = nullptr)
 {
-    if (!g_opts.Parse(argv) || g_opts.help)
+    int const tileWidth = g_opts.tileWidth;
+    int const tileHeight = g_opts.tileHeight;
+    int const columns = (img.Width() + tileWidth - 1) / tileWidth;
+    int const rows = (img.Height() + tileHeight - 1) / tileHeight;
+    size_t const count = size_t(columns) * rows;
+
+    std::filesystem::path output(outputFile);
+    std::string const stem = output.stem().string();
+    std::string const ext = output.extension().string();
+
+    auto tileName = [&](int row, int col)
     {
-        g_opts.ShowHelp(std::cout);
-        return g_opts.help ? 0 : 1;
+        return stem + "-" + std::to_string(row) + "-" + std::to_string(col) + ext;
+    };
+
+    log << "Writing " << count << " tiles of " << tileWidth << "x" << tileHeight << " as "
+        << (output.parent_path() / tileName(0, 0)).string() << " and so on...\n";
+    progress.Stage("converting tiles", count, "tiles");
+
+    std::vector<std::string> files(count);
+    auto tileFile = [&](size_t i) { return tileName(int(i / columns), int(i % columns)); };
+    auto tilePath = [&](size_t i) { return (output.parent_path() / tileFile(i)).string(); };
+
+    bool ok = ConvertEachInParallel(count, "Tile", opts, log, progress, tilePath,
+        [&](size_t i, ConvertOptions const& tileOpts, std::ostream& tileLog)
+    {
+        int x = int(i % columns) * tileWidth;
+        int y = int(i / columns) * tileHeight;
+        int w = std::min(tileWidth, img.Width() - x);
+        int h = std::min(tileHeight, img.Height() - y);
+        std::string name = tilePath(i);
+        files[i] = tileFile(i);
+
+        std::error_code ec;
+        if (previous && !RectChanged(img, *previous, x, y, w, h) && std::filesystem::is_regular_file(name, ec))
+        {
+            if (stats) ++stats->reusedTiles;
+            return true;
+        }
+
+        RasterImage tile = img.Crop(x, y, w, h);
+        ImageRowSource tileRows(tile);
+
+        ConvertedTiles::Tile* own = nullptr;
+        if (converted && tile.Valid())
+        {
+            std::ostringstream dims;
+            dims << w << "x" << h << "x" << tile.ChannelCount();
+            uint64_t hash = ContentHash(tile.Pixel(0, 0), tile.SizeInBytes(), ContentHash(dims.str()));
+
+            std::unique_lock<std::mutex> lock(converted->mutex);
+            for (;;)
+            {
+                ConvertedTiles::Tile* same = nullptr;
+                auto [begin, end] = converted->tiles.equal_range(hash);
+                for (auto it = begin; it != end && !same; ++it)
+                {
+                    ConvertedTiles::Tile& t = it->second;
+                    if (t.state != ConvertedTiles::State::failed && t.w == w && t.h == h
+                        && SameRect(*t.img, t.x, t.y, img, x, y, w, h))
+                    {
+                        same = &t;
+                    }
+                }
+
+                if (!same)
+                {
+                    own = &converted->tiles.emplace(hash, ConvertedTiles::Tile{&img, x, y, w, h, files[i]})->second;
+                    break;
+                }
+                if (same->state == ConvertedTiles::State::converted)
+                {
+                    files[i] = same->file;
+                    if (stats) ++stats->reusedTiles;
+                    return true;
+                }
+                converted->finished.wait(lock);
+            }
+        }
+
+        bool ok = tile.Valid() && WriteSvgFileCached(name, tileRows, tile, tileOpts, tileLog, stats, nullptr, styles);
+        if (own)
+        {
+            {
+                std::lock_guard<std::mutex> lock(converted->mutex);
+                own->state = ok ? ConvertedTiles::State::converted : ConvertedTiles::State::failed;
+            }
+            converted->finished.notify_all();
+        }
+        return ok;
+    });
+
+    auto fields = [&](std::ostream& manifest)
+    {
+        manifest << ",\n  \"tile_width\": " << tileWidth
+                 << ",\n  \"tile_height\": " << tileHeight
+                 << ",\n  \"rows\": " << rows
+                 << ",\n  \"columns\": " << columns;
+    };
+    auto entry = [&](std::ostream& manifest, size_t i)
+    {
+        int row = int(i / columns);
+        int col = int(i % columns);
+        int x = col * tileWidth;
+        int y = row * tileHeight;
+        manifest << "\"file\": " << JsonQuote(files[i])
+                 << ", \"row\": " << row << ", \"column\": " << col
+                 << ", \"x\": " << x << ", \"y\": " << y
+                 << ", \"width\": " << std::min(tileWidth, img.Width() - x)
+                 << ", \"height\": " << std::min(tileHeight, img.Height() - y);
+    };
+    return WriteManifest(output.parent_path() / (stem + ".tiles.json"), "tile", img.Width(), img.Height(), opts.scale, log,
+                         fields, "tiles", count, entry)
+        && ok;
+}
+
+// With --frames, convert every frame of an animated GIF to an SVG file of its own, named
+// after the output file with the frame number added, and list them with their delays
+// in a JSON manifest also named after the output file.  Frames with the same pixels as
+// an earlier one aren't converted again; the manifest names the earlier one's file.
+// All frames share one palette: with --max-colors, colors are reduced over all frames
+// together, so a color doesn't change from frame to frame, and with --group css, every
+// frame links to one style sheet.  With --tile, each frame is split into tiles, and a
+// tile with the same pixels as any converted before, in any frame, is converted once.
+
+bool ConvertFrames(std::vector<RasterImage>& frames, std::vector<int> const& delaysMs, std::string const& outputFile,
+    ConvertOptions const& opts, std::ostream& log, ConversionStats* stats, ProgressReporter& progress)
+{
+    std::filesystem::path output(outputFile);
+    std::string const stem = output.stem().string();
+    std::string const ext = output.extension().string();
+
+    auto frameName = [&](size_t f)
+    {
+        return stem + "-" + std::to_string(f) + ext;
+    };
+
+    // Only frames that differ from all before them are converted.  Frames whose hashes
+    // match are compared too, so a collision can't make one stand in for another.
+    progress.Stage("hashing frames", frames.size(), "frames");
+    std::vector<size_t> sourceOf(frames.size());
+    std::vector<RasterImage*> distinct;
+    std::unordered_multimap<uint64_t, size_t> distinctWithHash;
+    for (size_t f = 0; f < frames.size(); ++f)
+    {
+        RasterImage const& frame = frames[f];
+        uint64_t hash = ContentHash(frame.Pixel(0, 0), frame.SizeInBytes());
+        sourceOf[f] = f;
+        auto [begin, end] = distinctWithHash.equal_range(hash);
+        for (auto it = begin; it != end && sourceOf[f] == f; ++it)
+        {
+            RasterImage const& other = frames[it->second];
+            if (other.Width() == frame.Width() && other.Height() == frame.Height()
+                && SameRect(other, 0, 0, frame, 0, 0, frame.Width(), frame.Height()))
+            {
+                sourceOf[f] = it->second;
+            }
+        }
+        if (sourceOf[f] == f)
+        {
+            distinctWithHash.emplace(hash, f);
+            distinct.push_back(&frames[f]);
+        }
+        progress.Advance(1);
+    }
+
+    log << "Writing " << distinct.size() << " distinct frames of " << frames.size() << " as "
+        << (output.parent_path() / frameName(0)).string() << " and so on...\n";
+    if (stats) stats->reusedFrames += frames.size() - distinct.size();
+
+    PhaseTimer converting(stats, Phase::convert);
+    if (opts.maxColors > 0)
+    {
+        progress.Stage("reducing colors");
+        if (!ReduceColorsTogether(distinct, size_t(opts.maxColors)))
+        {
+            log << "Cannot reduce the colors of the frames!\n";
+            return false;
+        }
+    }
+
+    SharedStyles styles;
+    styles.styleSheet = stem + ".css";
+    SharedStyles const* shared = nullptr;
+    if (opts.group == GroupMode::css)
+    {
+        progress.Stage("indexing colors");
+        std::vector<RasterImage::RGBA> row(frames[0].Width());
+        for (RasterImage const* frame : distinct)
+        {
+            for (int r = 0; r < frame->Height(); ++r)
+            {
+                frame->GetRowRGBA(r, row.data());
+                styles.palette.AddRow(row.data(), row.size());
+            }
+        }
+
+        PixelEmitter emitter(LayoutFor(opts, frames[0].Width(), frames[0].Height()), opts.strokeWidth, ShapeStyle::classed);
+        TextBuffer text;
+        for (uint32_t c = 0; c < styles.palette.Size(); ++c)
+        {
+            if (PixelEmitter::IsVisible(styles.palette.Color(c))) emitter.EmitClassRule(text, styles.palette.Color(c), c);
+        }
+
+        std::filesystem::path styleSheetName = output.parent_path() / styles.styleSheet;
+        std::ofstream styleSheet(styleSheetName, std::ios::binary);
+        styleSheet.write(text.Data(), std::streamsize(text.Size()));
+        if (!styleSheet.flush())
+        {
+            log << "Cannot write style sheet " << styleSheetName.string() << "!\n";
+            return false;
+        }
+        shared = &styles;
+    }
+    converting.Stop();
+
+    bool ok = true;
+    if (g_opts.tile.specified)
+    {
+        // Frames one at a time, each with all threads on its tiles
+        ConvertedTiles converted;
+        for (RasterImage const* frame : distinct)
+        {
+            std::string name = (output.parent_path() / frameName(size_t(frame - frames.data()))).string();
+            if (!ConvertTiles(*frame, nullptr, name, opts, log, stats, progress, shared, &converted)) ok = false;
+        }
     }
+    else
+    {
+        progress.Stage("converting frames", distinct.size(), "frames");
+        auto framePath = [&](size_t i) { return (output.parent_path() / frameName(size_t(distinct[i] - frames.data()))).string(); };
+
+        ok = ConvertEachInParallel(distinct.size(), "Frame", opts, log, progress, framePath,
+            [&](size_t i, ConvertOptions const& frameOpts, std::ostream& frameLog)
+        {
+            ImageRowSource rows(*distinct[i]);
+            return WriteSvgFileCached(framePath(i), rows, *distinct[i], frameOpts, frameLog, stats, nullptr, shared);
+        });
+    }
+
+    auto fields = [&](std::ostream& manifest)
+    {
+        if (shared) manifest << ",\n  \"style_sheet\": " << JsonQuote(styles.styleSheet);
+    };
+    auto entry = [&](std::ostream& manifest, size_t f)
+    {
+        std::string name = frameName(sourceOf[f]);
+        if (g_opts.tile.specified)
+        {
+            manifest << "\"tiles\": " << JsonQuote(std::filesystem::path(name).stem().string() + ".tiles.json");
+        }
+        else
+        {
+            manifest << "\"file\": " << JsonQuote(name);
+        }
+        manifest << ", \"delay_ms\": " << delaysMs[f];
+    };
+    return WriteManifest(output.parent_path() / (stem + ".frames.json"), "frame", frames[0].Width(), frames[0].Height(),
+                         opts.scale, log, fields, "frames", frames.size(), entry)
+        && ok;
+}
+
+// Convert one image file to an SVG file, reporting progress to "log" at the given
+// interval (never if 0), and adding to "stats" if given
 
-    std::cout << "Converting " << g_opts.inputFile << " to " << g_opts.outputFile << ".\n"
+bool ConvertFile(std::string const& inputFile, std::string const& outputFile, ConvertOptions const& opts, std::ostream& log,
+    ConversionStats* stats, steady_clock::duration progressInterval)
+{
+    log << "Converting " << inputFile << " to " << outputFile << ".\n"
         << "Loading input image...\n";
 
-    RasterImage img(g_opts.inputFile);
+    ProgressReporter progress(log, progressInterval);
+    progress.Stage("loading");
 
-    std::cout << "Image is " << img.Width() << "x" << img.Height()
-        << ", with " << img.ChannelCount() << " color channels.\n";
+    // Streamable modes read the image by rows, other modes need all of it at once, as
+    // do cutting it into tiles, looking it up in the cache and comparing it
+    PhaseTimer decoding(stats, Phase::decode);
+    RasterImage img;
+    RasterImage previous;
+    std::vector<RasterImage> frames;
+    std::vector<int> delaysMs;
+    std::unique_ptr<RasterRowSource> rows;
+    std::string framesFailure;
+    if (g_opts.frames)
+    {
+        frames = RasterImage::LoadFrames(inputFile.c_str(), delaysMs, framesFailure);
+        rows = std::make_unique<ImageRowSource>(frames.empty() ? img : frames[0]);
+        if (!frames.empty()) log << "Image has " << frames.size() << " frames.\n";
+    }
+    else if (IsStreamable(opts) && !g_opts.tile.specified && !g_opts.cache.specified && !g_opts.diffFrom.specified)
+    {
+        rows = OpenRowSource(inputFile);
+    }
+    else
+    {
+        img.Load(inputFile);
+        rows = std::make_unique<ImageRowSource>(img);
+    }
+    if (g_opts.diffFrom.specified) previous.Load(g_opts.diffFrom.value);
+    decoding.Stop();
 
-    auto svgDoc = RasterPixelsToSvg(img, g_opts.outputFile);
+    std::string const& failure = g_opts.frames ? framesFailure : rows->FailureReason();
+    if (g_opts.frames ? frames.empty() : !rows->Valid())
+    {
+        log << "Cannot load " << inputFile << ": " << failure << "\n";
+        if (stats) ++stats->failures;
+        return false;
+    }
 
-    std::cout << "SVG paths generated.  Writing output .svg file...\n";
+    log << "Image is " << rows->Width() << "x" << rows->Height()
+        << ", with " << rows->ChannelCount() << " color channels.\n";
+
+    bool success;
+    if (g_opts.frames)
+    {
+        success = !frames.empty() && ConvertFrames(frames, delaysMs, outputFile, opts, log, stats, progress);
+    }
+    else if (g_opts.tile.specified)
+    {
+        RasterImage const* unchangedFrom = SameLayout(img, previous) ? &previous : nullptr;
+        success = img.Valid() && ConvertTiles(img, unchangedFrom, outputFile, opts, log, stats, progress);
+    }
+    else if (g_opts.diffFrom.specified)
+    {
+        log << "Writing output .svg file, from the changes since " << g_opts.diffFrom.value << "...\n";
+        success = img.Valid() && WriteSvgFileSpliced(outputFile, img, previous, opts, log, stats, &progress);
+    }
+    else
+    {
+        log << "Writing output " << (IsCompressedOutput(outputFile) ? ".svgz" : ".svg") << " file...\n";
+        success = WriteSvgFileCached(outputFile, *rows, img, opts, log, stats, &progress);
+    }
+    progress.Stop();
+
+    if (stats)
+    {
+        ++(success ? stats->images : stats->failures);
+        stats->pixels += uint64_t(rows->Width()) * uint64_t(rows->Height()) * std::max<uint64_t>(frames.size(), 1);
+    }
 
-    bool success = svgDoc.save();
     if (!success)
     {
-        std::cout << "File output failed!\n";
-        return 1;
+        log << (g_opts.frames ? "Frame output failed!\n" : g_opts.tile.specified ? "Tiled output failed!\n" : "File output failed!\n");
+        return false;
     }
 
-    std::cout << "Completed successfully.\n";
-    return 0;
-}
\ No newline at end of file
+    log << "Conversion time: " << duration_cast<milliseconds>(progress.Elapsed()).count() << " ms\n"
+        << "Completed successfully.\n";
+    return true;
+}
+
+// With --dry-run, work out the size of an image's SVG instead of converting it
+
+bool EstimateFile(std::string const& inputFile, ConvertOptions const& opts, std::ostream& log)
+{
+    // Only streamable modes are counted by rows; the others convert the whole image
+    RasterImage img;
+    std::unique_ptr<RasterRowSource> rows;
+    if (IsStreamable(opts))
+    {
+        rows = OpenRowSource(inputFile);
+    }
+    else
+    {
+        img.Load(inputFile);
+        rows = std::make_unique<ImageRowSource>(img);
+    }
+    if (!rows->Valid())
+    {
+        log << "Cannot load " << inputFile << ": " << rows->FailureReason() << "\n";
+        return false;
+    }
+
+    log << "Image is " << rows->Width() << "x" << rows->Height()
+        << ", with " << rows->ChannelCount() << " color channels.\n";
+
+    OutputEstimate estimate;
+    bool ok = img.Valid() ? EstimateOutput(img, opts, estimate) : EstimateOutput(*rows, opts, estimate);
+    if (!ok)
+    {
+        log << (rows->Valid() ? "Conversion failed\n" : "Error reading input image: " + rows->FailureReason() + "\n");
+        return false;
+    }
+
+    log << "Expected output: " << estimate.elements << " elements, " << estimate.bytes << " bytes of SVG.\n";
+    return true;
+}
+
+// Convert all files of a batch, several at a time.  Each file is converted by a single
+// thread, since with many files that keeps all threads busy without any hand-offs.
+// Only failures are reported in full, so the log isn't swamped.
+
+bool ConvertBatch(ConversionStats* stats)
+{
+    std::vector<BatchFile> files;
+    std::string error;
+    std::filesystem::path outputDir = g_opts.outputFile.specified ? g_opts.outputFile.value : "";
+    if (!ExpandBatchInputs(g_opts.batch.values, outputDir, g_opts.svgz ? "svgz" : "svg", files, error))
+    {
+        std::cout << error << "\n";
+        return false;
+    }
+
+    std::cout << "Converting " << files.size() << " files using " << g_opts.threads << " threads.\n";
+
+    auto startTime = now();
+    std::mutex logMutex;
+    std::atomic<size_t> failures{0};
+
+    ConvertOptions opts = g_opts.convert;
+    opts.threads = 1;
+
+    ForEachTaskStealing(files.size(), g_opts.threads, [&](size_t i)
+    {
+        BatchFile const& f = files[i];
+        std::ostringstream log;
+
+        std::error_code ec;
+        if (f.output.has_parent_path()) std::filesystem::create_directories(f.output.parent_path(), ec);
+
+        bool ok = ConvertFile(f.input.string(), f.output.string(), opts, log, stats, 0s);
+        if (!ok) ++failures;
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        if (ok)
+            std::cout << f.input.string() << " -> " << f.output.string() << "\n";
+        else
+            std::cout << "FAILED: " << f.input.string() << "\n" << log.str();
+    });
+
+    auto durMs = duration_cast<milliseconds>(now() - startTime).count();
+    std::cout << "Converted " << files.size() - failures << " of " << files.size()
+        << " files in " << durMs << " ms\n";
+
+    return failures == 0;
+}
+
+// Options of a --daemon job: those of the command line, changed by any of the job's
+// fields "scale", "stroke_width", "merge", "group", "max_colors" and "background",
+// named and checked as on the command line.  On failure, "error" says why.
+
+bool JobOptions(JsonObject const& job, ConvertOptions& opts, std::string& error)
+{
+    for (auto const& [key, value] : job.Fields())
+    {
+        auto bad = [&]
+        {
+            error = "Bad value for " + key + ": " + value.ToJson();
+            return false;
+        };
+        auto number = [&](double& result)
+        {
+            char* end = nullptr;
+            if (value.IsNumber()) result = strtod(value.text.c_str(), &end);
+            return value.IsNumber() && *end == 0 && isfinite(result);
+        };
+        auto name = [&](auto const& names, auto& result)
+        {
+            auto found = names.Val(value.text);
+            if (value.IsString() && found.found) result = found.val;
+            return value.IsString() && found.found;
+        };
+
+        double n = 0;
+        if (key == "id" || key == "input" || key == "output") continue;
+        else if (key == "scale")
+        {
+            if (!number(n) || !(n > 0)) return bad();
+            opts.scale = n;
+        }
+        else if (key == "stroke_width")
+        {
+            if (!number(n) || !(n >= 0)) return bad();
+            opts.strokeWidth = n;
+        }
+        else if (key == "max_colors")
+        {
+            if (!number(n) || !(n >= 0 && n <= double(IndexedImage::MaxColors)) || n != int(n)) return bad();
+            opts.maxColors = int(n);
+        }
+        else if (key == "merge")
+        {
+            if (!name(EnumNameMapFor(MergeMode{}), opts.merge)) return bad();
+        }
+        else if (key == "group")
+        {
+            if (!name(EnumNameMapFor(GroupMode{}), opts.group)) return bad();
+        }
+        else if (key == "background")
+        {
+            if (!value.IsString() || (value.text != "auto" && value.text != "none")) return bad();
+            opts.autoBackground = value.text == "auto";
+        }
+        else
+        {
+            error = "Unknown field " + JsonQuote(key);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run one --daemon job, converting its input to its output file if it names one, and
+// otherwise to "svg", with the command line's options as changed by the job's.  On
+// failure, "error" says why, and "log" has the messages of the conversion, if it got
+// that far.
+
+bool RunJob(JsonObject const& job, ConvertOptions const& baseOpts, MemoryOutputSink& svg, ConversionStats* stats,
+    std::string& error, std::string& log)
+{
+    ConvertOptions opts = baseOpts;
+    if (!JobOptions(job, opts, error)) return false;
+
+    JsonValue const* input = job.Find("input");
+    JsonValue const* output = job.Find("output");
+    if (!input || !input->IsString())
+    {
+        error = "No input file name";
+        return false;
+    }
+    if (output && !output->IsString())
+    {
+        error = "Output file name isn't a string";
+        return false;
+    }
+
+    // The SVG of a job without an output file comes back framed on stdout, which
+    // raw output written to "-" would corrupt
+    if (output && (output->text.empty() || output->text == "-"))
+    {
+        error = "Output file name must name a file";
+        return false;
+    }
+
+    std::ostringstream messages;
+    if (output)
+    {
+        bool ok = ConvertFile(input->text, output->text, opts, messages, stats, 0s);
+        if (!ok)
+        {
+            error = "Conversion failed";
+            log = messages.str();
+        }
+        return ok;
+    }
+
+    if (g_opts.tile.specified || g_opts.frames)
+    {
+        error = "--tile and --frames need an output file";
+        return false;
+    }
+
+    PhaseTimer decoding(stats, Phase::decode);
+    RasterImage img(input->text);
+    decoding.Stop();
+
+    bool ok = img.Valid();
+    if (ok)
+    {
+        svg.Clear();
+        if (g_opts.svgz)
+        {
+            GzipOutputSink gzip(svg, 1);
+            ok = Convert(img, opts, gzip, stats, nullptr, &ThreadArena());
+        }
+        else
+        {
+            ok = Convert(img, opts, svg, stats, nullptr, &ThreadArena());
+        }
+        ThreadArena().Release();
+        if (!ok) error = "Conversion failed";
+    }
+    else
+    {
+        error = "Cannot load " + input->text + ": " + img.FailureReason();
+    }
+
+    if (stats)
+    {
+        ++(ok ? stats->images : stats->failures);
+        stats->pixels += uint64_t(img.Width()) * uint64_t(img.Height());
+        if (ok) stats->fileBytes += svg.Size();
+    }
+    return ok;
+}
+
+// With --daemon, convert jobs read from stdin, one JSON object per line, naming an
+// input file and optionally an output file:
+//
+//   {"id": 7, "input": "sprite.png"}
+//   {"id": "b", "input": "map.png", "output": "out/map.svg", "merge": "regions"}
+//
+// Jobs are converted concurrently by a fixed set of worker threads, one per --threads,
+// started once, so a job costs only its conversion, not a process and its start-up.
+// Each job gets one JSON line back on stdout, in the order jobs finish, with its id:
+// {"id": 7, "ok": true, "bytes": 1234} followed by exactly that many bytes of SVG, or
+// with an output file, {"id": "b", "ok": true, "output": "out/map.svg"}.  Failures get
+// {"id": ..., "ok": false, "error": "..."}.  The options on the command line apply to
+// every job, except as its fields change them (see JobOptions).  Runs until the end of stdin, and returns once every job is done.
+
+bool ServeJobs(ConversionStats* stats)
+{
+    FileOutputSink out("-", 64 << 10);
+    std::mutex outMutex;
+    std::atomic<size_t> failures{0};
+    WorkQueue<std::string> jobs;
+
+    auto respond = [&](std::string const& header, char const* data, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(outMutex);
+        out.Write(header);
+        out.Write(data, size);
+        out.Flush();
+    };
+
+    // Each job is converted by one thread
+    ConvertOptions opts = g_opts.convert;
+    opts.threads = 1;
+
+    auto worker = [&]
+    {
+        // Kept from job to job, so collecting the SVG soon stops allocating
+        MemoryOutputSink svg;
+        JsonObject job;
+        std::string line;
+
+        while (jobs.Pop(line))
+        {
+            std::string error;
+            std::string log;
+            bool ok = job.Parse(line, error) && RunJob(job, opts, svg, stats, error, log);
+
+            JsonValue const* id = job.Find("id");
+            std::string header = "{\"id\":" + (id ? id->ToJson() : std::string("null"));
+            if (!ok)
+            {
+                ++failures;
+                header += ",\"ok\":false,\"error\":" + JsonQuote(error);
+                if (!log.empty()) header += ",\"log\":" + JsonQuote(log);
+                respond(header + "}\n", nullptr, 0);
+            }
+            else if (JsonValue const* output = job.Find("output"))
+            {
+                respond(header + ",\"ok\":true,\"output\":" + JsonQuote(output->text) + "}\n", nullptr, 0);
+            }
+            else
+            {
+                respond(header + ",\"ok\":true,\"bytes\":" + std::to_string(svg.Size()) + "}\n", svg.Data(), svg.Size());
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < g_opts.threads; ++t)
+    {
+        workers.emplace_back(worker);
+    }
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+        jobs.Push(std::move(line));
+    }
+    jobs.Close();
+
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+    return failures == 0 && out.Close();
+}
+
+// Print the statistics, and write them as JSON, as the options ask
+
+bool ReportStats(ConversionStats& stats, std::ostream& log)
+{
+    stats.Finish();
+    if (g_opts.stats) stats.WriteReport(log);
+
+    if (g_opts.statsJson.specified)
+    {
+        std::ofstream json(g_opts.statsJson.value);
+        stats.WriteJson(json);
+        if (!json.flush())
+        {
+            log << "Cannot write statistics to " << g_opts.statsJson.value << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char** argv)
+{
+    if (!g_opts.Parse(argv) || g_opts.help)
+    {
+        g_opts.ShowHelp(std::cout);
+        return g_opts.help ? 0 : 1;
+    }
+
+    ConversionStats stats;
+    bool wantStats = g_opts.stats || g_opts.statsJson.specified;
+
+    // Keep progress messages out of the SVG when it is written to stdout
+    std::ostream& log = g_opts.outputFile.value == "-" || g_opts.daemon ? std::cerr : std::cout;
+
+    bool ok =
+        g_opts.daemon          ? ServeJobs(wantStats ? &stats : nullptr) :
+        g_opts.batch.specified ? ConvertBatch(wantStats ? &stats : nullptr) :
+        g_opts.dryRun          ? EstimateFile(g_opts.inputFile, g_opts.convert, log) :
+        ConvertFile(g_opts.inputFile, g_opts.outputFile, g_opts.convert, log, wantStats ? &stats : nullptr,
+                    duration_cast<steady_clock::duration>(duration<double>(g_opts.progress.value)));
+
+    if (wantStats && !ReportStats(stats, log)) ok = false;
+    return ok ? 0 : 1;
+}
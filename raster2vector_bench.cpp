@@ -0,0 +1,306 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+// Throughput benchmark: converts synthetic images of several kinds and sizes in each
+// merge mode, writing to a sink that only counts bytes, so only the conversion itself
+// is measured.  Reports pixels and output bytes per second of the best of several
+// runs, and the memory a run takes at its peak, beyond what the process held when it
+// started, and its allocation count.
+
+#include "Convert.h"
+#include "BandPipeline.h"
+#include "IndexedImage.h"
+#include "CommandLine.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Peak resident memory since the last ResetPeakMemory(), in bytes.  Resetting sets the
+// peak to the memory resident at the time, including whatever earlier runs left
+// behind, so a run's own peak is PeakMemory() less CurrentMemory() right after the
+// reset.  Memory freed by earlier runs is handed back to the OS first where the C
+// library can, so a run can't reuse it without it counting.  Only Linux can reset the
+// peak or tell the current memory; elsewhere the peak is that of the whole process so
+// far, or 0 if the OS can't tell, and the current memory is 0.
+
+void ResetPeakMemory()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+#ifdef __linux__
+uint64_t StatusMemory(char const* field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t const length = strlen(field);
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, length, field) == 0) return std::stoull(line.substr(length)) * 1024;
+    }
+    return 0;
+}
+#endif
+
+uint64_t CurrentMemory()
+{
+#ifdef __linux__
+    return StatusMemory("VmRSS:");
+#else
+    return 0;
+#endif
+}
+
+uint64_t PeakMemory()
+{
+#ifdef __linux__
+    return StatusMemory("VmHWM:");
+#elif defined(_WIN32)
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return uint64_t(usage.ru_maxrss);  // Bytes on macOS
+#endif
+}
+
+struct BenchOptions : CommandLine::Parser
+{
+    ValueList<string> patterns {is, "-p", "--patterns", {"noise", "flat", "gradient", "sprites"},
+                                                            "Kinds of synthetic image: noise, flat, gradient, sprites."};
+    ValueList<int>    sizes    {is, "-s", "--sizes",    {16, 256, 1024, 4096},
+                                                            "Image widths and heights, 16 to 16384."};
+    ValueList<string> merges   {is, "-m", "--merge",    {"none", "runs", "blocks", "rects", "regions"},
+                                                            "Merge modes to measure."};
+    Enum<GroupMode>   group    {is, "-g", "--group",    GroupMode::none, "Group mode for all runs."};
+    Value<int>        maxColors {is, "-c", "--max-colors", 0,  "Color reduction for all runs, as for raster2vector."};
+    Value<int>        threads  {is, "-t", "--threads",  0,  "Number of worker threads.  Default (0) is one per hardware thread."};
+    Value<int>        repeat   {is, "-r", "--repeat",   3,  "Runs of each case, of which the fastest is reported."};
+    Option            help     {is, "-h", "--help",         "Show this help text."};
+
+    bool Validate() override
+    {
+        static char const* const knownPatterns[] = {"noise", "flat", "gradient", "sprites"};
+        for (auto const& p : patterns.values)
+        {
+            if (std::find(std::begin(knownPatterns), std::end(knownPatterns), p) == std::end(knownPatterns)) return false;
+        }
+        for (auto const& m : merges.values)
+        {
+            if (EnumNameMapFor(MergeMode{}).nameToVal.count(m) == 0) return false;
+        }
+        for (int s : sizes.values)
+        {
+            if (s < 16 || s > 16384) return false;
+        }
+        if (maxColors < 0 || size_t(maxColors.value) > IndexedImage::MaxColors) return false;
+        if (threads < 0 || repeat < 1 || otherArgs.size() != 0) return false;
+        if (threads == 0) threads.value = HardwareThreadCount();
+        return true;
+    }
+} g_bench;
+
+// Synthetic test images, the same every time for each pattern and size:
+// - noise: random RGB, so nothing merges
+// - flat: RGB cells of a few colors, so neighboring cells often merge into regions
+// - gradient: RGB ramps across and down, giving short runs on wide images
+// - sprites: RGBA tiles of 16x16 mirrored sprites in a few colors, on transparency
+
+RasterImage MakeImage(std::string const& pattern, int size)
+{
+    std::mt19937 rng{uint32_t(size)};
+    RasterImage img;
+
+    if (pattern == "noise")
+    {
+        img.Create(size, size, 3);
+        for (int r = 0; r < size; ++r)
+        {
+            auto* p = img.Pixel(r, 0);
+            for (int i = 0; i < size * 3; ++i) p[i] = RasterImage::PixData_t(rng());
+        }
+    }
+    else if (pattern == "flat")
+    {
+        static RasterImage::PixData_t const colors[6][3] = {
+            {255, 255, 255}, {200, 40, 40}, {40, 160, 60}, {30, 60, 200}, {240, 200, 40}, {20, 20, 20} };
+        int cell = std::max(4, size / 16);
+        int cells = (size + cell - 1) / cell;
+        std::vector<int> cellColor(size_t(cells) * cells);
+        for (int& c : cellColor) c = int(rng() % 6);
+
+        img.Create(size, size, 3);
+        for (int r = 0; r < size; ++r)
+        {
+            for (int c = 0; c < size; ++c)
+            {
+                memcpy(img.Pixel(r, c), colors[cellColor[size_t(r / cell) * cells + c / cell]], 3);
+            }
+        }
+    }
+    else if (pattern == "gradient")
+    {
+        img.Create(size, size, 3);
+        for (int r = 0; r < size; ++r)
+        {
+            for (int c = 0; c < size; ++c)
+            {
+                auto* p = img.Pixel(r, c);
+                p[0] = RasterImage::PixData_t(c * 256 / size);
+                p[1] = RasterImage::PixData_t(r * 256 / size);
+                p[2] = 128;
+            }
+        }
+    }
+    else
+    {
+        // Each sprite uses transparency and three colors of four-color palettes
+        constexpr int Tile = 16;
+        constexpr int SpriteCount = 8;
+        std::vector<uint8_t> sprites(SpriteCount * Tile * Tile);
+        for (int s = 0; s < SpriteCount; ++s)
+        {
+            for (int r = 0; r < Tile; ++r)
+            {
+                for (int c = 0; c < Tile / 2; ++c)
+                {
+                    uint8_t v = rng() % 2 ? 0 : uint8_t(1 + rng() % 3);
+                    sprites[(s * Tile + r) * Tile + c] = v;
+                    sprites[(s * Tile + r) * Tile + Tile - 1 - c] = v;
+                }
+            }
+        }
+
+        static RasterImage::PixData_t const palettes[4][4][4] = {
+            {{0, 0, 0, 0}, {20, 20, 20, 255}, {220, 60, 40, 255}, {250, 220, 160, 255}},
+            {{0, 0, 0, 0}, {20, 20, 20, 255}, {40, 120, 220, 255}, {200, 230, 255, 255}},
+            {{0, 0, 0, 0}, {30, 60, 20, 255}, {80, 180, 60, 255}, {230, 250, 200, 128}},
+            {{0, 0, 0, 0}, {60, 20, 80, 255}, {170, 80, 220, 255}, {250, 250, 250, 255}} };
+
+        int tiles = (size + Tile - 1) / Tile;
+        std::vector<uint8_t> tileSprite(size_t(tiles) * tiles);
+        std::vector<uint8_t> tilePalette(tileSprite.size());
+        for (size_t t = 0; t < tileSprite.size(); ++t)
+        {
+            tileSprite[t] = uint8_t(rng() % SpriteCount);
+            tilePalette[t] = uint8_t(rng() % 4);
+        }
+
+        img.Create(size, size, 4);
+        for (int r = 0; r < size; ++r)
+        {
+            for (int c = 0; c < size; ++c)
+            {
+                size_t t = size_t(r / Tile) * tiles + c / Tile;
+                uint8_t v = sprites[(tileSprite[t] * Tile + r % Tile) * Tile + c % Tile];
+                memcpy(img.Pixel(r, c), palettes[tilePalette[t]][v], 4);
+            }
+        }
+    }
+
+    return img;
+}
+
+int main(int, const char** argv)
+{
+    if (!g_bench.Parse(argv) || g_bench.help)
+    {
+        g_bench.ShowHelp(std::cout);
+        return g_bench.help ? 0 : 1;
+    }
+
+    ConvertOptions opts;
+    opts.group = g_bench.group;
+    opts.maxColors = g_bench.maxColors;
+    opts.threads = g_bench.threads;
+
+    std::cout << "Using " << g_bench.threads << " threads, best of " << g_bench.repeat << " runs, group "
+        << EnumNameMapFor(GroupMode{}).Name(opts.group) << "\n\n"
+        << std::left << std::setw(10) << "pattern" << std::setw(7) << "size" << std::setw(9) << "merge"
+        << std::right << std::setw(10) << "ms" << std::setw(11) << "Mpixel/s" << std::setw(9) << "MB/s"
+        << std::setw(11) << "output MB" << std::setw(10) << "image MB" << std::setw(10) << "peak MB" << std::setw(11) << "allocs" << "\n";
+
+    bool ok = true;
+    for (auto const& pattern : g_bench.patterns.values)
+    {
+        for (int size : g_bench.sizes.values)
+        {
+            RasterImage img = MakeImage(pattern, size);
+            if (!img.Valid())
+            {
+                std::cout << pattern << " " << size << ": " << img.FailureReason() << "\n";
+                ok = false;
+                continue;
+            }
+
+            for (auto const& merge : g_bench.merges.values)
+            {
+                opts.merge = EnumNameMapFor(MergeMode{}).nameToVal.at(merge);
+
+                double bestSeconds = 0;
+                uint64_t outputSize = 0;
+                uint64_t allocs = 0;
+                uint64_t peak = 0;
+                for (int run = 0; run < g_bench.repeat && ok; ++run)
+                {
+                    CountingOutputSink sink;
+                    ResetPeakMemory();
+                    uint64_t memoryBefore = CurrentMemory();
+                    uint64_t allocsBefore = g_allocationCount;
+                    auto start = std::chrono::steady_clock::now();
+
+                    ok = Convert(img, opts, sink);
+
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    if (run == 0 || seconds < bestSeconds) bestSeconds = seconds;
+                    outputSize = sink.Size();
+                    allocs = g_allocationCount - allocsBefore;
+                    uint64_t runPeak = PeakMemory();
+                    peak = std::max(peak, runPeak > memoryBefore ? runPeak - memoryBefore : 0);
+                }
+
+                double pixels = double(size) * size;
+                std::cout << std::left << std::setw(10) << pattern << std::setw(7) << size << std::setw(9) << merge
+                    << std::right << std::fixed << std::setprecision(2)
+                    << std::setw(10) << bestSeconds * 1e3
+                    << std::setprecision(1) << std::setw(11) << pixels / bestSeconds / 1e6
+                    << std::setw(9) << outputSize / bestSeconds / 1e6
+                    << std::setw(11) << outputSize / 1e6
+                    << std::setw(10) << double(img.SizeInBytes()) / 1e6
+                    << std::setw(10) << peak / 1e6
+                    << std::setw(11) << allocs << std::endl;
+
+                if (!ok)
+                {
+                    std::cout << "Conversion failed!\n";
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,658 @@
+/*
+* Copyright 2021 Jason Scott Cohen.  All rights reserved.
+*
+* Licensed under the Apache License v2.0 with LLVM Exceptions.
+* See https://llvm.org/LICENSE.txt for license information.
+* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+*/
+
+// The conversion library, raster2vector_core, which also holds the implementations of
+// stb_image and stb_image_write for every program linking it
+
+#include "Convert.h"
+#include "BandPipeline.h"
+#include "RegionTrace.h"
+#include "IndexedImage.h"
+#include "TextBuffer.h"
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <string.h>
+#include <algorithm>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace
+{
+
+// Colors of an image's pixels, looked up in the palette of its indexed form if it has one
+
+struct PixelColors
+{
+    RasterImage const& img;
+    IndexedImage const& indexed;
+
+    RasterImage::RGBA At(int row, int col) const
+    {
+        return indexed.Valid() ? indexed.ColorAt(row, col) : img.GetPixelRGBA(row, col);
+    }
+
+    // Only if the indexed form is valid
+    uint32_t IndexAt(int row, int col) const
+    {
+        return indexed.IndexAt(row, col);
+    }
+};
+
+// The color drawn once behind everything by --background auto: the most frequent one,
+// with ties going to the smaller key, as in MostFrequentColor().  Only if every other
+// pixel is opaque, since a background showing through transparent or translucent
+// pixels would change how they look.
+
+bool FindBackground(RasterImage const& img, IndexedImage const& indexed, RasterImage::RGBA& background)
+{
+    if (indexed.Valid())
+    {
+        Palette const& palette = indexed.GetPalette();
+        if (palette.Size() == 0) return false;
+
+        uint32_t best = 0;
+        for (uint32_t c = 1; c < palette.Size(); ++c)
+        {
+            uint64_t count = indexed.PixelCount(c);
+            if (count > indexed.PixelCount(best)
+                || (count == indexed.PixelCount(best) && Palette::Key(palette.Color(c)) < Palette::Key(palette.Color(best))))
+            {
+                best = c;
+            }
+        }
+        for (uint32_t c = 0; c < palette.Size(); ++c)
+        {
+            if (c != best && indexed.PixelCount(c) > 0 && palette.Color(c).a != 0xFF) return false;
+        }
+        background = palette.Color(best);
+        return true;
+    }
+
+    background = MostFrequentColor(img);
+    std::vector<RasterImage::RGBA> row(img.Width());
+    for (int r = 0; r < img.Height(); ++r)
+    {
+        img.GetRowRGBA(r, row.data());
+        for (RasterImage::RGBA color : row)
+        {
+            if (color.a != 0xFF && Palette::Key(color) != Palette::Key(background)) return false;
+        }
+    }
+    return true;
+}
+
+// Lists of shapes of one kind, adapted for writing in any group mode
+
+struct RectShapes
+{
+    PixelColors const& colors;
+    PixelEmitter const& emitter;
+    std::pmr::vector<ColorRect> rects; // Empty if every pixel is its own shape
+    bool pixels;
+
+    int Count() const { return pixels ? colors.img.Width() * colors.img.Height() : int(rects.size()); }
+
+    ColorRect At(int i) const
+    {
+        int width = colors.img.Width();
+        return pixels ? ColorRect{i % width, i / width, 1, 1} : rects[i];
+    }
+
+    RasterImage::RGBA ColorAt(int i) const
+    {
+        ColorRect rect = At(i);
+        return colors.At(rect.y, rect.x);
+    }
+
+    uint32_t IndexAt(int i) const
+    {
+        ColorRect rect = At(i);
+        return colors.IndexAt(rect.y, rect.x);
+    }
+
+    void Emit(int i, TextBuffer& text, RasterImage::RGBA color, uint32_t colorIndex) const
+    {
+        ColorRect rect = At(i);
+        emitter.EmitRect(text, rect.x, rect.y, rect.w, rect.h, color, colorIndex);
+    }
+
+    void EmitSubpaths(int i, TextBuffer& text, GridPoint const* from) const
+    {
+        emitter.EmitRectSubpath(text, At(i), from);
+    }
+
+    GridPoint LastSubpathStart(int i) const
+    {
+        ColorRect rect = At(i);
+        return GridPoint{rect.x, rect.y};
+    }
+};
+
+struct RegionShapes
+{
+    PixelColors const& colors;
+    PixelEmitter const& emitter;
+    std::pmr::vector<RegionOutline> regions;
+
+    int Count() const { return int(regions.size()); }
+
+    RasterImage::RGBA ColorAt(int i) const
+    {
+        return colors.At(regions[i].row, regions[i].col);
+    }
+
+    uint32_t IndexAt(int i) const
+    {
+        return colors.IndexAt(regions[i].row, regions[i].col);
+    }
+
+    void Emit(int i, TextBuffer& text, RasterImage::RGBA color, uint32_t colorIndex) const
+    {
+        emitter.EmitPath(text, regions[i], color, colorIndex);
+    }
+
+    void EmitSubpaths(int i, TextBuffer& text, GridPoint const* from) const
+    {
+        emitter.EmitOutlineSubpaths(text, regions[i], from);
+    }
+
+    GridPoint LastSubpathStart(int i) const
+    {
+        return PixelEmitter::LastSubpathStart(regions[i]);
+    }
+};
+
+} // namespace
+
+// Count the elements and bytes each band of rows would take as streamed output, with
+// the lengths PixelEmitter would format them with, but without formatting anything.
+// Bands are counted in parallel, into counts of their own, which are added up at the
+// end.
+
+static bool CountStreamedOutput(RasterRowSource& source, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress)
+{
+    svg::Layout const layout = LayoutFor(opts, source.Width(), source.Height());
+    PixelEmitter emitter(layout, opts.strokeWidth);
+    int const width = source.Width();
+    size_t const rowSize = source.RowSizeInBytes();
+    int const bandRows = RowsPerBand(width);
+    bool const perPixel = opts.merge == MergeMode::none;
+
+    struct BandPixels
+    {
+        RasterImage::PixData_t const* rows = nullptr;
+        std::vector<RasterImage::PixData_t> buffer;
+        std::vector<RasterImage::RGBA> colors;
+    };
+    struct BandCount
+    {
+        uint64_t elements = 0;
+        uint64_t bytes = 0;
+    };
+    std::vector<BandCount> bands((source.Height() + bandRows - 1) / bandRows);
+    if (progress) progress->Stage("estimating output", uint64_t(source.Height()), "rows");
+
+    auto readBand = [&](int, int rowBegin, int rowEnd, BandPixels& pixels)
+    {
+        pixels.rows = source.ReadRows(rowEnd - rowBegin, pixels.buffer);
+        return pixels.rows != nullptr;
+    };
+
+    auto countBandOf = [&](auto channelCount)
+    {
+        constexpr int Channels = decltype(channelCount)::value;
+
+        return [&](int band, int rowBegin, int rowEnd, BandPixels& pixels, TextBuffer&)
+        {
+            BandCount& count = bands[band];
+            auto& colors = pixels.colors;
+            colors.resize(width);
+
+            for (int r = rowBegin; r < rowEnd; ++r)
+            {
+                auto const* row = pixels.rows + (r - rowBegin) * rowSize;
+                ConvertPixelsToRGBA(row, Channels, reinterpret_cast<RasterImage::PixData_t*>(colors.data()), size_t(width));
+
+                auto addRect = [&](int colBegin, int colEnd)
+                {
+                    if (!PixelEmitter::IsVisible(colors[colBegin])) return;
+                    count.bytes += emitter.RectLength(colBegin, r, colEnd - colBegin, 1, colors[colBegin]);
+                    ++count.elements;
+                };
+                if (perPixel)
+                {
+                    for (int c = 0; c < width; ++c) addRect(c, c + 1);
+                }
+                else
+                {
+                    ForEachRun<Channels>(row, width, addRect);
+                }
+            }
+        };
+    };
+
+    auto countedBand = [&](int band, TextBuffer const&)
+    {
+        if (progress) progress->Advance(uint64_t(std::min(bandRows, source.Height() - band * bandRows)));
+        return true;
+    };
+
+    bool ok = WithChannelCount(source.ChannelCount(), [&](auto channelCount)
+    {
+        return ForEachBandOrdered<BandPixels>(source.Height(), bandRows, opts.threads, readBand, countBandOf(channelCount),
+                                              countedBand);
+    });
+    if (!ok) return false;
+
+    estimate = OutputEstimate{};
+    estimate.bytes = SvgWriter::Header(layout).size() + SvgWriter::Trailer().size();
+    for (BandCount const& count : bands)
+    {
+        estimate.elements += count.elements;
+        estimate.bytes += count.bytes;
+        estimate.bandBytes = std::max(estimate.bandBytes, size_t(count.bytes));
+    }
+    return true;
+}
+
+// How shapes merge and group decides the size of the output in the other modes, so the
+// image is converted, into a sink that only counts bytes
+
+static bool CountConvertedOutput(RasterImage const& img, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress)
+{
+    ConversionStats counts;
+    CountingOutputSink sink;
+    SvgWriter doc(sink, LayoutFor(opts, img.Width(), img.Height()), &counts);
+    if (!RasterPixelsToSvg(img, doc, opts, &counts, progress)) return false;
+
+    estimate = OutputEstimate{};
+    estimate.elements = counts.elements;
+    estimate.bytes = sink.Size();
+    return true;
+}
+
+bool EstimateOutput(RasterImage const& img, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress)
+{
+    if (!IsStreamable(opts)) return CountConvertedOutput(img, opts, estimate, progress);
+
+    ImageRowSource rows(img);
+    return CountStreamedOutput(rows, opts, estimate, progress);
+}
+
+bool EstimateOutput(RasterRowSource& source, ConvertOptions const& opts, OutputEstimate& estimate,
+    ProgressReporter* progress)
+{
+    if (IsStreamable(opts)) return CountStreamedOutput(source, opts, estimate, progress);
+
+    // Shapes can only be merged with the whole image in memory
+    if (progress) progress->Stage("loading", uint64_t(source.Height()), "rows");
+    RasterImage img(source.Width(), source.Height(), source.ChannelCount());
+    if (!img.Valid()) return false;
+
+    std::vector<RasterImage::PixData_t> buffer;
+    int const bandRows = RowsPerBand(source.Width());
+    for (int row = 0; row < source.Height(); row += bandRows)
+    {
+        int rowCount = std::min(bandRows, source.Height() - row);
+        RasterImage::PixData_t const* rows = source.ReadRows(rowCount, buffer);
+        if (!rows) return false;
+        memcpy(img.Pixel(row, 0), rows, size_t(rowCount) * source.RowSizeInBytes());
+        if (progress) progress->Advance(uint64_t(rowCount));
+    }
+    return CountConvertedOutput(img, opts, estimate, progress);
+}
+
+// Convert pixels to polygons, one per pixel or per run of identical pixels in a row,
+// reading the image a band of rows at a time.  Bands are serialized in parallel, and
+// streamed to the writer in order as they complete, so only the bands in flight are
+// ever in memory, both as pixels and as text.
+
+bool StreamPixelsToSvg(RasterRowSource& source, SvgWriter& doc, ConvertOptions const& opts, ConversionStats* stats,
+    ProgressReporter* progress, OutputEstimate const* estimate)
+{
+    if (!doc.Begin()) return false;
+
+    PixelEmitter emitter(doc.GetLayout(), opts.strokeWidth);
+    int const width = source.Width();
+    size_t const rowSize = source.RowSizeInBytes();
+
+    int bandRows = RowsPerBand(width);
+    if (progress) progress->Stage("converting", uint64_t(source.Height()), "rows");
+
+    // Each slot of the pipeline keeps its buffers, so bands allocate nothing once the
+    // first few have been through
+    struct BandPixels
+    {
+        RasterImage::PixData_t const* rows = nullptr;
+        std::vector<RasterImage::PixData_t> buffer;
+        std::vector<RasterImage::RGBA> colors;  // Scratch for the producer
+        Palette bandColors;                     // Only counted for stats
+    };
+
+    // Distinct colors of all bands, for stats
+    std::mutex colorsMutex;
+    Palette imageColors;
+
+    auto readBand = [&](int, int rowBegin, int rowEnd, BandPixels& pixels)
+    {
+        PhaseTimer phases(stats, Phase::decode);
+        pixels.rows = source.ReadRows(rowEnd - rowBegin, pixels.buffer);
+        return pixels.rows != nullptr;
+    };
+
+    // Instantiated for each channel count, so run detection has no per-pixel switch
+    auto convertBandOf = [&](auto channelCount)
+    {
+        constexpr int Channels = decltype(channelCount)::value;
+
+        return [&](int, int rowBegin, int rowEnd, BandPixels& pixels, TextBuffer& text)
+        {
+            PhaseTimer phases(stats, Phase::serialize);
+            uint64_t elements = 0;
+            if (stats) pixels.bandColors.Clear();
+
+            // Colors of a whole row are converted at once
+            auto& colors = pixels.colors;
+            colors.resize(width);
+
+            for (int r = rowBegin; r < rowEnd; ++r)
+            {
+                auto const* row = pixels.rows + (r - rowBegin) * rowSize;
+                phases.Switch(Phase::convert);
+                ConvertPixelsToRGBA(row, Channels, reinterpret_cast<RasterImage::PixData_t*>(colors.data()), size_t(width));
+                if (stats) pixels.bandColors.AddRow(colors.data(), colors.size());
+                phases.Switch(Phase::serialize);
+
+                elements += EmitStreamedRow<Channels>(emitter, opts.merge, row, colors.data(), r, width, text);
+            }
+
+            if (stats)
+            {
+                stats->elements += elements;
+                std::lock_guard<std::mutex> lock(colorsMutex);
+                for (uint32_t i = 0; i < pixels.bandColors.Size(); ++i)
+                {
+                    imageColors.Add(pixels.bandColors.Color(i));
+                }
+            }
+        };
+    };
+
+    auto writeBand = [&](int band, TextBuffer const& text)
+    {
+        if (!doc.Write(text.Data(), text.Size())) return false;
+        if (progress)
+        {
+            progress->Advance(uint64_t(std::min(bandRows, source.Height() - band * bandRows)));
+            progress->SetBytesWritten(doc.BytesWritten());
+        }
+        return true;
+    };
+
+    bool ok = WithChannelCount(source.ChannelCount(), [&](auto channelCount)
+    {
+        // The last element of a band is formatted with room for the longest possible one
+        size_t const textCapacity = estimate ? estimate->bandBytes + emitter.MaxLength() : 0;
+        return ForEachBandOrdered<BandPixels>(source.Height(), bandRows, opts.threads, readBand, convertBandOf(channelCount), writeBand,
+                                              textCapacity);
+    });
+    if (!ok) return false;
+
+    if (stats) stats->colors += imageColors.Size();
+    if (progress) progress->Stage("closing output");
+    return doc.End();
+}
+
+// First block of a conversion's arena: enough for a few shapes per row, so small images
+// need only the one block
+static size_t ArenaInitialSize(RasterImage const& img)
+{
+    return std::clamp<size_t>(size_t(img.Height()) * 16 * sizeof(ColorRect), 4096, 16 << 20);
+}
+
+// Convert pixels to polygons, one per pixel, per run of identical pixels in a row,
+// or per merged rectangle, or to one path per region, according to the merge mode,
+// or to one path per color.  Colors are reduced first if --max-colors says so.
+// Bands of the shape list are serialized in parallel, and streamed to the writer in
+// order as they complete.  Given shared styles, every color of the image must be in
+// their palette.
+
+bool RasterPixelsToSvg(RasterImage const& img, SvgWriter& doc, ConvertOptions const& opts, ConversionStats* stats,
+    ProgressReporter* progress, SharedStyles const* styles, ConversionArena* reused)
+{
+    if (!doc.Begin()) return false;
+
+    PixelEmitter emitter(doc.GetLayout(), opts.strokeWidth, StyleForGroupMode(opts));
+
+    // Shape lists and the scratch space for finding them are allocated from an arena
+    // that is freed all at once when the image is done, so the allocation count doesn't
+    // grow with the number of shapes.  The caller's arena keeps its memory from image
+    // to image; without one, a conversion has an arena of its own.
+    std::optional<ConversionArena> ownArena;
+    ConversionArena& conversionArena = reused ? *reused : ownArena.emplace();
+    std::pmr::memory_resource* arena = conversionArena.Begin(ArenaInitialSize(img));
+
+    // Shapes are found in the indexed image where possible, since it's smaller.  Photos
+    // may have too many colors, unless they get reduced.
+    if (progress) progress->Stage("indexing colors");
+    PhaseTimer converting(stats, Phase::convert);
+    IndexedImage indexed = IndexedImage::FromImage(img, size_t(opts.maxColors));
+    RasterImage const& pixels = indexed.Valid() ? indexed.Indices() : img;
+    PixelColors colors{img, indexed};
+
+    // The most frequent color may be drawn once, behind everything, and left out of shapes
+    RasterImage::RGBA background{};
+    bool hasBackground = opts.autoBackground && FindBackground(img, indexed, background);
+
+    if (stats) stats->colors += indexed.Valid() ? indexed.GetPalette().Size() : CountColors(img);
+    converting.Stop();
+
+    auto isDrawn = [&](RasterImage::RGBA color)
+    {
+        return PixelEmitter::IsVisible(color)
+            && !(hasBackground && Palette::Key(color) == Palette::Key(background));
+    };
+
+    if (hasBackground && PixelEmitter::IsVisible(background))
+    {
+        TextBuffer text;
+        emitter.EmitBackground(text, img.Width(), img.Height(), background);
+        if (stats) ++stats->elements;
+        if (!doc.Write(text.Data(), text.Size())) return false;
+    }
+
+    // Serialize a list of shapes in bands with as many elements as a band of pixels.
+    // emitOne returns the number of SVG elements it started.
+    auto writeList = [&](int count, auto&& emitOne)
+    {
+        int bandItems = RowsPerBand(1);
+        if (progress) progress->Stage("writing", uint64_t(count), "shapes");
+
+        auto convertBand = [&](int, int begin, int end, TextBuffer& text)
+        {
+            PhaseTimer phases(stats, Phase::serialize);
+            uint64_t elements = 0;
+            for (int i = begin; i < end; ++i)
+            {
+                elements += emitOne(i, text);
+            }
+            if (stats) stats->elements += elements;
+        };
+
+        auto writeBand = [&](int band, TextBuffer const& text)
+        {
+            if (!doc.Write(text.Data(), text.Size())) return false;
+            if (progress)
+            {
+                progress->Advance(uint64_t(std::min(bandItems, count - band * bandItems)));
+                progress->SetBytesWritten(doc.BytesWritten());
+            }
+            return true;
+        };
+
+        // The output is closed as soon as the last shape is written, before the shape
+        // lists are freed
+        if (!ForEachBandOrdered(count, bandItems, opts.threads, convertBand, writeBand)) return false;
+        if (progress) progress->Stage("closing output");
+        return true;
+    };
+
+    // Write shapes in order, or bucketed by color, with shared attributes as needed
+    auto writeShapes = [&](auto const& shapes)
+    {
+        int count = shapes.Count();
+
+        if (opts.group == GroupMode::none)
+        {
+            return writeList(count, [&](int i, TextBuffer& text)
+            {
+                RasterImage::RGBA color = shapes.ColorAt(i);
+                if (!isDrawn(color)) return 0;
+                shapes.Emit(i, text, color, 0);
+                return 1;
+            });
+        }
+
+        if (progress) progress->Stage("grouping by color");
+        PhaseTimer bucketing(stats, Phase::merge);
+        auto buckets = indexed.Valid()
+            ? BucketByIndex(count, indexed.GetPalette(), [&](size_t i) { return shapes.IndexAt(int(i)); })
+            : BucketByColor(count, [&](size_t i) { return shapes.ColorAt(int(i)); });
+        auto const& palette = buckets.palette;
+        bucketing.Stop();
+
+        // Classes are numbered by the shared palette if there is one
+        std::vector<uint32_t> classOf(palette.Size());
+        for (uint32_t c = 0; c < palette.Size(); ++c)
+        {
+            classOf[c] = styles ? styles->palette.IndexOf(palette.Color(c)) : c;
+        }
+
+        TextBuffer text;
+        if (opts.group == GroupMode::css && styles)
+        {
+            text.Append("<style type=\"text/css\">@import url(\"" + styles->styleSheet + "\");</style>\n");
+        }
+        else if (opts.group == GroupMode::css)
+        {
+            text.Append("<style type=\"text/css\"><![CDATA[\n");
+            for (uint32_t c = 0; c < palette.Size(); ++c)
+            {
+                if (isDrawn(palette.Color(c))) emitter.EmitClassRule(text, palette.Color(c), c);
+            }
+            text.Append("]]></style>\n");
+        }
+        if (emitter.HasStroke()) text.Append(emitter.StrokeGroupStart());
+        if (!doc.Write(text.Data(), text.Size())) return false;
+
+        bool ok;
+        if (opts.group == GroupMode::css)
+        {
+            ok = writeList(count, [&](int i, TextBuffer& text)
+            {
+                uint32_t c = buckets.elementColor[i];
+                if (!isDrawn(palette.Color(c))) return 0;
+                shapes.Emit(i, text, palette.Color(c), classOf[c]);
+                return 1;
+            });
+        }
+        else if (opts.group == GroupMode::fill)
+        {
+            ok = writeList(count, [&](int k, TextBuffer& text)
+            {
+                int i = buckets.order[k];
+                uint32_t c = buckets.elementColor[i];
+                if (!isDrawn(palette.Color(c))) return 0;
+                if (uint32_t(k) == buckets.bucketStart[c]) emitter.EmitFillGroupStart(text, palette.Color(c));
+                shapes.Emit(i, text, palette.Color(c), c);
+                if (uint32_t(k) + 1 == buckets.bucketStart[c + 1]) emitter.EmitGroupEnd(text);
+                return 1;
+            });
+        }
+        else
+        {
+            // Each shape's subpaths start relative to the previous shape of the same color
+            ok = writeList(count, [&](int k, TextBuffer& text)
+            {
+                int i = buckets.order[k];
+                uint32_t c = buckets.elementColor[i];
+                if (!isDrawn(palette.Color(c))) return 0;
+                bool first = uint32_t(k) == buckets.bucketStart[c];
+                if (first)
+                {
+                    emitter.EmitColorPathStart(text, palette.Color(c));
+                    shapes.EmitSubpaths(i, text, nullptr);
+                }
+                else
+                {
+                    GridPoint from = shapes.LastSubpathStart(buckets.order[k - 1]);
+                    shapes.EmitSubpaths(i, text, &from);
+                }
+                if (uint32_t(k) + 1 == buckets.bucketStart[c + 1]) emitter.EmitColorPathEnd(text);
+                return first ? 1 : 0;
+            });
+        }
+
+        return ok && (!emitter.HasStroke() || doc.Write(svg::elemEnd("g")));
+    };
+
+    bool ok;
+    PhaseTimer merging(stats, Phase::merge);
+    if (opts.merge == MergeMode::regions)
+    {
+        RegionShapes shapes{colors, emitter, TraceRegions(pixels, arena, progress)};
+        merging.Stop();
+        ok = writeShapes(shapes);
+    }
+    else
+    {
+        if (progress && opts.merge != MergeMode::none) progress->Stage("merging", uint64_t(img.Height()), "rows");
+        std::pmr::vector<ColorRect> rects =
+            opts.merge == MergeMode::runs   ? CollectRuns(pixels, arena, progress) :
+            opts.merge == MergeMode::blocks ? MergeRunsVertically(pixels, arena, progress) :
+            opts.merge == MergeMode::rects  ? MergeGreedyRects(pixels, arena, progress) :
+            std::pmr::vector<ColorRect>(arena);
+        merging.Stop();
+
+        ok = writeShapes(RectShapes{colors, emitter, std::move(rects), opts.merge == MergeMode::none});
+    }
+
+    if (!ok) return false;
+
+    return doc.End();
+}
+
+bool Convert(RasterImage const& img, ConvertOptions const& opts, OutputSink& sink, ConversionStats* stats,
+    OutputEstimate const* estimate, ConversionArena* arena)
+{
+    if (estimate) sink.Preallocate(estimate->bytes);
+
+    SvgWriter doc(sink, LayoutFor(opts, img.Width(), img.Height()), stats);
+    bool ok;
+    if (IsStreamable(opts))
+    {
+        ImageRowSource rows(img);
+        ok = StreamPixelsToSvg(rows, doc, opts, stats, nullptr, estimate);
+    }
+    else
+    {
+        ok = RasterPixelsToSvg(img, doc, opts, stats, nullptr, nullptr, arena);
+    }
+    if (stats) stats->svgBytes += doc.BytesWritten();
+    return ok;
+}